@@ -2,7 +2,7 @@
 IPCManager.h
 Copyright (c) Bit Software, Inc.(2015), All rights reserved.
 
-Purpose: 实现命名管道的进程间通信
+Purpose: 实现进程间通信，Windows下为命名管道，Linux下为Unix域套接字
 
 Author: xjh
 
@@ -21,9 +21,18 @@ Created Time: 2015-4-26
 	#include<sys/ipc.h>
 	#include<sys/types.h>
 	#include<sys/stat.h>
+	#include<sys/socket.h>
+	#include<sys/un.h>
+	#include<sys/epoll.h>
 	#include<fcntl.h>
+	#include<errno.h>
 #endif
 
+#include<string>
+#include<vector>
+#include<deque>
+#include<map>
+
 // 记录错误日志
 static void RecordErrorLog(const char* errMsg, int line)
 {
@@ -64,12 +73,12 @@ public:
 
 	~NamePipeSender()
 	{
-		ClosePipe();
+		Close();
 	}
 
 	bool Connect()
 	{
-		ClosePipe();
+		Close();
 
 		wchar_t* wPipeName = __MultiByteToWideChar(_pipeName.c_str());
 		BOOL ret = WaitNamedPipe(wPipeName, 1000);
@@ -87,13 +96,8 @@ public:
 			FILE_ATTRIBUTE_NORMAL,
 			NULL);
 
-		if (_hPipe == INVALID_HANDLE_VALUE)
-		{
-			delete[] wPipeName;
-			return false;
-		}
-
-		return true;
+		delete[] wPipeName;
+		return _hPipe != INVALID_HANDLE_VALUE;
 	}
 
 	bool SendMsg(const char* msg, size_t msgLen, size_t& realSize)
@@ -108,12 +112,13 @@ public:
 		return true;
 	}
 
-	bool GetReplyMsg(char* msg, size_t msgLen, size_t realLen)
+	bool GetReplyMsg(char* msg, size_t msgLen, size_t& realLen)
 	{
 		assert(_hPipe != INVALID_HANDLE_VALUE);
 
+		// 留一个字节给'\0'
 		DWORD readSize;
-		if (!ReadFile(_hPipe, msg, msgLen, &readSize, NULL))
+		if (!ReadFile(_hPipe, msg, msgLen - 1, &readSize, NULL))
 		{
 			return false;
 		}
@@ -124,11 +129,12 @@ public:
 		return true;
 	}
 
-	void ClosePipe()
+	void Close()
 	{
 		if (_hPipe != INVALID_HANDLE_VALUE)
 		{
 			CloseHandle(_hPipe);
+			_hPipe = INVALID_HANDLE_VALUE;
 		}
 	}
 
@@ -148,12 +154,16 @@ public:
 
 	~NamePipeReceiver()
 	{
-		ClosePipe();
+		Close();
 	}
 
+	//
+	// 创建新的管道实例等待下一个客户端，上一个客户端的连接在这里断开。
+	// ps：一次回复可能有多帧，断开前要等客户端读完，否则未读的帧会被丢弃。
+	//
 	bool Listen()
 	{
-		ClosePipe();
+		Close();
 
 		wchar_t* wPipeName = __MultiByteToWideChar(_pipeName.c_str());
 
@@ -180,13 +190,14 @@ public:
 		assert(_hPipe != INVALID_HANDLE_VALUE);
 		BOOL ret = ConnectNamedPipe(_hPipe, NULL);
 
-		if (!ret)
+		// 客户端在ConnectNamedPipe之前已连接时也是成功
+		if (!ret && GetLastError() != ERROR_PIPE_CONNECTED)
 		{
 			return false;
 		}
 
 		DWORD readSize;
-		if (!ReadFile(_hPipe, msg, msgLen, &readSize, NULL))
+		if (!ReadFile(_hPipe, msg, msgLen - 1, &readSize, NULL))
 		{
 			return false;
 		}
@@ -209,12 +220,15 @@ public:
 		return true;
 	}
 
-	void ClosePipe()
+	void Close()
 	{
 		if (_hPipe != INVALID_HANDLE_VALUE)
 		{
+			// 等待客户端读完已写入的回复再断开
+			FlushFileBuffers(_hPipe);
 			DisconnectNamedPipe(_hPipe);
 			CloseHandle(_hPipe);
+			_hPipe = INVALID_HANDLE_VALUE;
 		}
 	}
 
@@ -225,121 +239,530 @@ private:
 
 #else
 
-class NamePipeSender
+//
+// Linux下使用Unix域套接字(SOCK_SEQPACKET)，保留消息边界，连接建立后一直保持，
+// 不需要每条消息都打开/关闭。服务端用epoll同时服务多个客户端，
+// 客户端接收慢时回复在该客户端的队列中排队，可写时再发送，不阻塞其他客户端。
+//
+
+// 设置套接字地址
+static bool SetSocketAddress(const string& path, sockaddr_un& addr)
+{
+	if (path.size() >= sizeof(addr.sun_path))
+	{
+		return false;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	return true;
+}
+
+// 套接字消息发送者
+class UnixSocketSender
 {
 public:
-	NamePipeSender(const char* pipeName)
+	UnixSocketSender(const char* pipeName)
 		:_pipeName(pipeName)
+		, _fd(-1)
 	{}
 
+	~UnixSocketSender()
+	{
+		Close();
+	}
+
+	// 连接服务端，已连接时直接返回
 	bool Connect()
 	{
+		if (_fd >= 0)
+		{
+			return true;
+		}
+
+		sockaddr_un addr;
+		if (!SetSocketAddress(_pipeName, addr))
+		{
+			return false;
+		}
+
+		_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (_fd < 0)
+		{
+			return false;
+		}
+
+		if (connect(_fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+		{
+			Close();
+			return false;
+		}
+
 		return true;
 	}
 
 	bool SendMsg(const char* msg, size_t msgLen, size_t& realSize)
 	{
-
-		int pipe_fd = open(_pipeName.c_str(), O_WRONLY| O_NONBLOCK);
-		int ret = write(pipe_fd, msg, msgLen);
-		if (ret == 0)
+		ssize_t ret = send(_fd, msg, msgLen, MSG_NOSIGNAL);
+		if (ret < 0)
 		{
-			return false;
+			// 连接已断开(如服务端重启)时重新连接一次
+			Close();
+			if (!Connect())
+			{
+				return false;
+			}
+
+			ret = send(_fd, msg, msgLen, MSG_NOSIGNAL);
+			if (ret < 0)
+			{
+				return false;
+			}
 		}
 
 		realSize = ret;
-		close(pipe_fd);
 		return true;
 	}
 
-	bool GetReplyMsg(char* msg, size_t msgLen, size_t realLen)
+	bool GetReplyMsg(char* msg, size_t msgLen, size_t& realLen)
 	{
-		int pipe_fd = open(_pipeName.c_str(), O_RDONLY);
-		int ret = read(pipe_fd, msg, msgLen);
-		if (ret == 0)
+		ssize_t ret;
+		do
+		{
+			ret = recv(_fd, msg, msgLen - 1, 0);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret <= 0)
 		{
+			Close();
 			return false;
 		}
 		msg[ret] = '\0';
 
 		realLen = ret;
-		close(pipe_fd);
 		return true;
 	}
+
+	void Close()
+	{
+		if (_fd >= 0)
+		{
+			close(_fd);
+			_fd = -1;
+		}
+	}
+
 private:
 	string _pipeName;
+	int _fd;			// 连接的套接字
 };
 
-class NamePipeReceiver
+// 套接字消息接收者
+class UnixSocketReceiver
 {
+	enum
+	{
+		MAX_EVENTS = 16,		// 一次等待的最大事件数
+		MAX_PENDING_SIZE = 64 * 1024 * 1024,	// 每个客户端排队的回复的最大字节数
+	};
+
+	// 已连接的客户端
+	struct Client
+	{
+		deque<string> _frames;	// 排队等待发送的消息
+		size_t _pendingSize;	// 排队的字节数
+
+		Client()
+			:_pendingSize(0)
+		{}
+	};
 public:
-	NamePipeReceiver(const char* pipeName)
+	UnixSocketReceiver(const char* pipeName)
 		:_pipeName(pipeName)
+		, _listenFd(-1)
+		, _epollFd(-1)
+		, _clientFd(-1)
+		, _eventCount(0)
+		, _eventIndex(0)
 	{}
 
+	~UnixSocketReceiver()
+	{
+		Close();
+	}
+
+	// 创建监听套接字，已在监听时直接返回
 	bool Listen()
 	{
+		if (_listenFd >= 0)
+		{
+			return true;
+		}
 
-		int ret= 0;
-		ret = mkfifo(_pipeName.c_str(), 0777);
-		if (ret != 0)
+		sockaddr_un addr;
+		if (!SetSocketAddress(_pipeName, addr))
 		{
 			return false;
 		}
 
+		// 同一路径的旧套接字文件是已退出的进程遗留的
+		unlink(_pipeName.c_str());
+
+		_listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		_epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (_listenFd < 0 || _epollFd < 0
+			|| bind(_listenFd, (sockaddr*)&addr, sizeof(addr)) < 0
+			|| chmod(_pipeName.c_str(), 0600) < 0
+			|| listen(_listenFd, SOMAXCONN) < 0
+			|| !_AddEvent(_listenFd))
+		{
+			Close();
+			return false;
+		}
+
 		return true;
 	}
 
-	bool ReceiverMsg(char* msg, size_t msgLen, size_t &realLen)
+	//
+	// 等待任意一个客户端的消息，等待的同时接受新的连接，关闭断开的连接，
+	// 并给可写的客户端发送排队的回复。收到消息的客户端记为当前客户端，回复发给它。
+	//
+	bool ReceiverMsg(char* msg, size_t msgLen, size_t& realLen)
+	{
+		while (1)
+		{
+			// 上一次等到的就绪事件处理完后再等待
+			if (_eventIndex == _eventCount)
+			{
+				int count = epoll_wait(_epollFd, _events, MAX_EVENTS, -1);
+				if (count < 0)
+				{
+					if (errno == EINTR)
+						continue;
+
+					return false;
+				}
+
+				_eventCount = count;
+				_eventIndex = 0;
+			}
+
+			const epoll_event& event = _events[_eventIndex++];
+			int fd = event.data.fd;
+			if (fd < 0)
+			{
+				continue;
+			}
+
+			if (fd == _listenFd)
+			{
+				_Accept();
+				continue;
+			}
+
+			if ((event.events & EPOLLOUT) && !_Flush(fd))
+			{
+				continue;
+			}
+
+			if (!(event.events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+			{
+				continue;
+			}
+
+			// 一次只读一条消息，还有消息时下一次等待仍会就绪
+			ssize_t ret = recv(fd, msg, msgLen - 1, MSG_DONTWAIT);
+			if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			{
+				continue;
+			}
+
+			if (ret <= 0)
+			{
+				_CloseClient(fd);
+				continue;
+			}
+
+			msg[ret] = '\0';
+			realLen = ret;
+			_clientFd = fd;
+
+			return true;
+		}
+	}
+
+	//
+	// 回复当前客户端，不等待。客户端的接收缓冲区满或还有排队的回复时，
+	// 消息追加到它的队列，可写时由ReceiverMsg发送；排队过多说明客户端
+	// 已不再接收，关闭连接。
+	//
+	bool SendReplyMsg(const char* msg, size_t msgLen, size_t& realSize)
 	{
+		map<int, Client>::iterator it = _clients.find(_clientFd);
+		if (it == _clients.end())
+		{
+			return false;
+		}
 
-		int pipe_fd = open(_pipeName.c_str(), O_RDONLY);
-		int ret = read(pipe_fd, msg, msgLen);
-		if (ret == 0)
+		Client& client = it->second;
+		if (client._frames.empty())
 		{
+			ssize_t ret;
+			do
+			{
+				ret = send(_clientFd, msg, msgLen, MSG_NOSIGNAL);
+			} while (ret < 0 && errno == EINTR);
+
+			if (ret >= 0)
+			{
+				realSize = ret;
+				return true;
+			}
+
+			if (errno != EAGAIN || !_ModifyEvent(_clientFd, EPOLLIN | EPOLLOUT))
+			{
+				_CloseClient(_clientFd);
+				return false;
+			}
+		}
+
+		if (client._pendingSize + msgLen > MAX_PENDING_SIZE)
+		{
+			_CloseClient(_clientFd);
 			return false;
 		}
-		msg[ret] = '\0';
 
-		realLen = ret;
-		close(pipe_fd);
+		client._frames.push_back(string(msg, msgLen));
+		client._pendingSize += msgLen;
+
+		realSize = msgLen;
 		return true;
 	}
 
-	bool SendReplyMsg(const char* msg, size_t msgLen, size_t& realSize)
+	void Close()
+	{
+		for (map<int, Client>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+		{
+			close(it->first);
+		}
+		_clients.clear();
+
+		if (_listenFd >= 0)
+		{
+			close(_listenFd);
+			unlink(_pipeName.c_str());
+			_listenFd = -1;
+		}
+
+		if (_epollFd >= 0)
+		{
+			close(_epollFd);
+			_epollFd = -1;
+		}
+
+		_clientFd = -1;
+		_eventCount = _eventIndex = 0;
+	}
+
+protected:
+	bool _AddEvent(int fd)
 	{
+		epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = fd;
 
-		int pipe_fd = open(_pipeName.c_str(), O_WRONLY| O_NONBLOCK);
-		int ret = write(pipe_fd, msg, msgLen);
-		if (ret == 0)
+		return epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+	}
+
+	bool _ModifyEvent(int fd, unsigned int events)
+	{
+		epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = events;
+		event.data.fd = fd;
+
+		return epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event) == 0;
+	}
+
+	//
+	// 发送客户端排队的回复，直到发完或接收缓冲区再次满，发完后不再等待可写。
+	// 发送失败时关闭连接并返回false。
+	//
+	bool _Flush(int fd)
+	{
+		map<int, Client>::iterator it = _clients.find(fd);
+		if (it == _clients.end())
 		{
 			return false;
 		}
 
-		realSize = ret;
-		close(pipe_fd);
+		Client& client = it->second;
+		while (!client._frames.empty())
+		{
+			const string& frame = client._frames.front();
+			ssize_t ret = send(fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+			if (ret < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				if (errno == EAGAIN)
+					return true;
+
+				_CloseClient(fd);
+				return false;
+			}
+
+			client._pendingSize -= frame.size();
+			client._frames.pop_front();
+		}
+
+		if (!_ModifyEvent(fd, EPOLLIN))
+		{
+			_CloseClient(fd);
+			return false;
+		}
+
 		return true;
 	}
 
+	// 接受所有等待中的连接
+	void _Accept()
+	{
+		while (1)
+		{
+			int fd = accept4(_listenFd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (fd < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				break;
+			}
+
+			if (!_AddEvent(fd))
+			{
+				close(fd);
+				continue;
+			}
+
+			_clients[fd] = Client();
+		}
+	}
+
+	void _CloseClient(int fd)
+	{
+		epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, NULL);
+		close(fd);
+
+		_clients.erase(fd);
+
+		// 本批次中该连接后续的事件作废
+		for (int i = _eventIndex; i < _eventCount; ++i)
+		{
+			if (_events[i].data.fd == fd)
+				_events[i].data.fd = -1;
+		}
+
+		if (_clientFd == fd)
+		{
+			_clientFd = -1;
+		}
+	}
+
 private:
 	string _pipeName;
+	int _listenFd;						// 监听套接字
+	int _epollFd;						// epoll
+	int _clientFd;						// 当前客户端，回复发给它
+	map<int, Client> _clients;			// 所有已连接的客户端
+	epoll_event _events[MAX_EVENTS];	// 上一次等到的就绪事件
+	int _eventCount;					// 就绪事件数
+	int _eventIndex;					// 下一个要处理的就绪事件
 };
 
 #endif
 
+#ifdef _WIN32
+typedef NamePipeSender IPCSender;
+typedef NamePipeReceiver IPCReceiver;
+#else
+typedef UnixSocketSender IPCSender;
+typedef UnixSocketReceiver IPCReceiver;
+#endif
+
+//
+// 请求/回复协议
+// 每条消息为一帧：帧头(数据长度 + 帧类型) + 数据，按帧头中的长度校验收到的消息。
+// 请求为一个REQUEST帧，数据为"命令\0参数"；回复按最大帧大小切分为若干个
+// REPLY_DATA帧，最后是一个REPLY_END帧，回复的大小不受缓冲区大小的限制。
+//
+enum IPC_FRAME_TYPE
+{
+	IPCFT_REQUEST = 1,		// 请求
+	IPCFT_REPLY_DATA = 2,	// 回复数据块
+	IPCFT_REPLY_END = 3,	// 回复结束
+};
+
+// 帧头
+struct IPCFrameHeader
+{
+	unsigned int _length;	// 数据长度，不含帧头
+	unsigned int _type;		// 帧类型
+};
+
+enum
+{
+	IPC_MAX_FRAME_SIZE = 64 * 1024,		// 最大帧大小(含帧头)
+	IPC_MAX_FRAME_DATA = IPC_MAX_FRAME_SIZE - sizeof(IPCFrameHeader),
+};
+
+// 组帧，返回帧的大小
+static size_t PackFrame(char* frame, unsigned int type, const char* data, size_t len)
+{
+	IPCFrameHeader header;
+	header._length = (unsigned int)len;
+	header._type = type;
+
+	memcpy(frame, &header, sizeof(header));
+	if (len)
+	{
+		memcpy(frame + sizeof(header), data, len);
+	}
+
+	return sizeof(header) + len;
+}
+
+// 解析帧，帧头中的长度和消息长度不一致时返回false
+static bool UnpackFrame(const char* frame, size_t frameLen, IPCFrameHeader& header)
+{
+	if (frameLen < sizeof(header))
+	{
+		return false;
+	}
+
+	memcpy(&header, frame, sizeof(header));
+
+	return header._length == frameLen - sizeof(header);
+}
+
 // IPC客户端
 class IPCClient
 {
 public:
 	IPCClient(const char* serverName)
 		:_sender(serverName)
+		, _buffer(IPC_MAX_FRAME_SIZE + 1)
 	{}
 
 	~IPCClient()
 	{}
 
-	// 发送消息给服务端
-	void SendMsg(char* buf, size_t bufLen)
+	// 发送消息给服务端，失败时返回false
+	bool SendMsg(char* buf, size_t bufLen)
 	{
 		size_t realLen;
 		if (!_sender.Connect())
@@ -350,21 +773,93 @@ public:
 		if (!_sender.SendMsg(buf, bufLen, realLen))
 		{
 			RECORD_ERROR_LOG("Client SendMsg Error\n");
+			return false;
 		}
+
+		return true;
 	}
 
-	// 获取服务端回复消息
-	void GetReplyMsg(char* buf, size_t bufLen)
+	// 获取服务端回复消息，失败时返回false，buf为空串
+	bool GetReplyMsg(char* buf, size_t bufLen)
 	{
 		size_t realLen = 0;
 		if (!_sender.GetReplyMsg(buf, bufLen, realLen))
 		{
 			RECORD_ERROR_LOG("Client GetReplyMsg Error\n");
+			buf[0] = '\0';
+			return false;
+		}
+
+		return true;
+	}
+
+	//
+	// 发送请求并接收完整的回复，回复分块接收后拼接到reply中。
+	// 失败时返回false，reply中为已收到的部分；连接同时关闭，丢弃未读的回复，
+	// 下一次请求重新连接，不会读到这次回复剩余的帧。
+	//
+	bool Request(const string& cmd, const string& args, string& reply)
+	{
+		reply.clear();
+
+		if (cmd.size() + 1 + args.size() > IPC_MAX_FRAME_DATA)
+		{
+			RECORD_ERROR_LOG("Client Request Too Long\n");
+			return false;
+		}
+
+		// 数据为"命令\0参数"
+		char* frame = &_buffer[0];
+		size_t dataLen = cmd.size() + 1 + args.size();
+		IPCFrameHeader header;
+		header._length = (unsigned int)dataLen;
+		header._type = IPCFT_REQUEST;
+		memcpy(frame, &header, sizeof(header));
+		memcpy(frame + sizeof(header), cmd.c_str(), cmd.size() + 1);
+		memcpy(frame + sizeof(header) + cmd.size() + 1, args.data(), args.size());
+
+		size_t realLen;
+		if (!_sender.Connect())
+		{
+			RECORD_ERROR_LOG("Client Connect Error\n");
+		}
+
+		if (!_sender.SendMsg(frame, sizeof(header) + dataLen, realLen))
+		{
+			RECORD_ERROR_LOG("Client SendMsg Error\n");
+			_sender.Close();
+			return false;
+		}
+
+		while (1)
+		{
+			if (!_sender.GetReplyMsg(frame, _buffer.size(), realLen))
+			{
+				RECORD_ERROR_LOG("Client GetReplyMsg Error\n");
+				_sender.Close();
+				return false;
+			}
+
+			if (!UnpackFrame(frame, realLen, header)
+				|| (header._type != IPCFT_REPLY_DATA && header._type != IPCFT_REPLY_END))
+			{
+				RECORD_ERROR_LOG("Client Invalid Reply Frame\n");
+				_sender.Close();
+				return false;
+			}
+
+			reply.append(frame + sizeof(header), header._length);
+
+			if (header._type == IPCFT_REPLY_END)
+			{
+				return true;
+			}
 		}
 	}
 
 private:
-	NamePipeSender _sender;			// 发送者
+	IPCSender _sender;			// 发送者
+	vector<char> _buffer;		// 帧缓冲区
 };
 
 // IPC服务端
@@ -373,24 +868,29 @@ class IPCServer
 public:
 	IPCServer(const char* serverName)
 		:_receiver(serverName)
+		, _buffer(IPC_MAX_FRAME_SIZE + 1)
 	{}
 
 	~IPCServer()
 	{}
 
-	// 接收客户端消息
-	void ReceiverMsg(char* buf, size_t bufLen)
+	// 接收客户端消息，失败时返回false
+	bool ReceiverMsg(char* buf, size_t bufLen)
 	{
 		size_t realLen;
 		if (!_receiver.Listen())
 		{
 			RECORD_ERROR_LOG("Server Listen Error\n");
+			return false;
 		}
 
 		if (!_receiver.ReceiverMsg(buf, bufLen, realLen))
 		{
 			RECORD_ERROR_LOG("Server ReceiverMsg Error\n");
+			return false;
 		}
+
+		return true;
 	}
 
 	// 回复客户端消息
@@ -402,6 +902,80 @@ public:
 			RECORD_ERROR_LOG("Server SendReplyMsg Error\n");
 		}
 	}
+
+	//
+	// 接收客户端的请求，解析出命令和参数。
+	// 接收失败时返回false；收到的不是合法的请求帧时命令为空串。
+	//
+	bool ReceiveRequest(string& cmd, string& args)
+	{
+		size_t realLen;
+		if (!_receiver.Listen())
+		{
+			RECORD_ERROR_LOG("Server Listen Error\n");
+			return false;
+		}
+
+		char* frame = &_buffer[0];
+		if (!_receiver.ReceiverMsg(frame, _buffer.size(), realLen))
+		{
+			RECORD_ERROR_LOG("Server ReceiverMsg Error\n");
+			return false;
+		}
+
+		cmd.clear();
+		args.clear();
+
+		IPCFrameHeader header;
+		if (!UnpackFrame(frame, realLen, header) || header._type != IPCFT_REQUEST)
+		{
+			return true;
+		}
+
+		// 数据为"命令\0参数"，没有'\0'时全部为命令
+		const char* data = frame + sizeof(header);
+		const char* end = data + header._length;
+		const char* sep = (const char*)memchr(data, '\0', header._length);
+		cmd.assign(data, sep ? sep : end);
+		if (sep)
+		{
+			args.assign(sep + 1, end);
+		}
+
+		return true;
+	}
+
+	//
+	// 回复客户端，按最大帧大小分块发送，最后发送结束帧。
+	// Linux下客户端接收慢时帧在接收者中排队，不阻塞其他客户端。
+	// 客户端断开时返回false，不再发送剩余的数据。
+	//
+	bool SendReply(const char* data, size_t len)
+	{
+		char* frame = &_buffer[0];
+		size_t realLen;
+		while (1)
+		{
+			size_t chunk = len < (size_t)IPC_MAX_FRAME_DATA ? len : (size_t)IPC_MAX_FRAME_DATA;
+			unsigned int type = chunk == len ? IPCFT_REPLY_END : IPCFT_REPLY_DATA;
+			size_t frameLen = PackFrame(frame, type, data, chunk);
+
+			if (!_receiver.SendReplyMsg(frame, frameLen, realLen))
+			{
+				RECORD_ERROR_LOG("Server SendReplyMsg Error\n");
+				return false;
+			}
+
+			if (type == IPCFT_REPLY_END)
+			{
+				return true;
+			}
+
+			data += chunk;
+			len -= chunk;
+		}
+	}
 private:
-	NamePipeReceiver _receiver;		// 接收者
+	IPCReceiver _receiver;		// 接收者
+	vector<char> _buffer;		// 帧缓冲区
 };
\ No newline at end of file
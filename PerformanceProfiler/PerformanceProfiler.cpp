@@ -1,7 +1,59 @@
 #include "PerformanceProfiler.h"
 
+#ifndef _WIN32
+#include <linux/perf_event.h>
+#endif
+
+//////////////////////////////////////////////////////////////
+// ConfigManager
+
+ConfigManager::Options ConfigManager::_sOptions;
+
+int ConfigManager::SetSectionEnable(const string& key, bool enable)
+{
+	SectionConfig config;
+	{
+		unique_lock<mutex> lock(_configMutex);
+		SectionConfig& rule = _sectionConfigMap[key];
+		rule._enable = enable;
+		config = rule;
+	}
+
+	return PerformanceProfiler::GetInstance()->ApplySectionConfig(key, config);
+}
+
+int ConfigManager::SetSectionSampling(const string& key, int mode, LongType rate)
+{
+	SectionConfig config;
+	{
+		unique_lock<mutex> lock(_configMutex);
+		SectionConfig& rule = _sectionConfigMap[key];
+		rule._sampleMode = mode;
+		rule._sampleRate = rate;
+		config = rule;
+	}
+
+	return PerformanceProfiler::GetInstance()->ApplySectionConfig(key, config);
+}
+
+bool ConfigManager::GetSectionConfig(const string& desc, const string& fileLine,
+	SectionConfig& config)
+{
+	unique_lock<mutex> lock(_configMutex);
+	SectionConfigMap::iterator it = _sectionConfigMap.find(fileLine);
+	if (it == _sectionConfigMap.end())
+	{
+		it = _sectionConfigMap.find(desc);
+		if (it == _sectionConfigMap.end())
+			return false;
+	}
+
+	config = it->second;
+	return true;
+}
+
 //////////////////////////////////////////////////////////////
-// Դͳ
+// 资源统计剖析
 //
 //static void RecordErrorLog(const char* errMsg, int line)
 //{
@@ -15,105 +67,370 @@
 //#define RECORD_ERROR_LOG(errMsg)		\
 //	RecordErrorLog(errMsg, __LINE__);
 
-void ResourceInfo::Update(LongType value)
+// 按两次样本的时间间隔更新时间常数为tau的指数加权移动平均
+static double UpdateEwma(double ewma, LongType value, LongType interval, double tau)
+{
+	double alpha = 1 - exp(-interval / tau);
+	return ewma + alpha * (value - ewma);
+}
+
+void ResourceInfo::Update(LongType value, LongType time)
 {
-	// value < 0ʱֱӷزٸ¡
+	// value < 0时则直接返回不再更新。
 	if (value < 0)
 		return;
 
 	if (value > _peak)
 		_peak = value;
 
-	//
-	// 㲻׼ȷƽֵܱ仯Ӱ첻
-	// Żɲο绬ڷڼ㡣
-	//
+	if (_count == 0)
+	{
+		_ewma1s = _ewma10s = _ewma60s = (double)value;
+	}
+	else
+	{
+		LongType interval = time - _lastTime;
+		_ewma1s = UpdateEwma(_ewma1s, value, interval, 1000);
+		_ewma10s = UpdateEwma(_ewma10s, value, interval, 10000);
+		_ewma60s = UpdateEwma(_ewma60s, value, interval, 60000);
+	}
+
+	_times[_count % SAMPLE_COUNT] = time;
+	_values[_count % SAMPLE_COUNT] = value;
+	_lastTime = time;
+
+	// 生命期的平均值只作参考，最近的情况看移动平均和最近样本的百分位
 	_total += value;
 	_avg = _total / (++_count);
 }
 
-ResourceStatistics::ResourceStatistics()
-	:_refCount(0)
-	,_statisticsThread(&ResourceStatistics::_Statistics, this)
+bool ResourceInfo::GetRecent(LongType window, LongType& peak, LongType& p50, LongType& p95) const
 {
-	// ʼͳԴϢ
-#ifdef _WIN32
-	_lastKernelTime = -1;
-	_lastSystemTime = -1;
-	_processHandle = ::GetCurrentProcess();
-	_cpuCount = _GetCpuCount();
-#else
-	_pid = getpid();
-#endif
+	LongType count = _count < SAMPLE_COUNT ? _count : (LongType)SAMPLE_COUNT;
+	vector<LongType> values;
+	values.reserve((size_t)count);
+
+	for (LongType i = _count - count; i < _count; ++i)
+	{
+		if (_lastTime - _times[i % SAMPLE_COUNT] <= window)
+			values.push_back(_values[i % SAMPLE_COUNT]);
+	}
+
+	if (values.empty())
+		return false;
+
+	sort(values.begin(), values.end());
+	peak = values.back();
+	p50 = values[(values.size() - 1) * 50 / 100];
+	p95 = values[(values.size() - 1) * 95 / 100];
+
+	return true;
 }
 
-ResourceStatistics::~ResourceStatistics()
+void ResourceInfo::Serialize(SaveAdapter& SA, const char* unit, LongType scale) const
 {
-#ifdef _WIN32
-	CloseHandle(_processHandle);
-#endif
+	LongType peak = 0, p50 = 0, p95 = 0;
+	if (!GetRecent(RECENT_WINDOW, peak, p50, p95))
+	{
+		SA.Save("No Sample\n");
+		return;
+	}
+
+	SA.Save("Recent %llds Peak:%lld%s, P50:%lld%s, P95:%lld%s, EWMA 1s:%lld%s, 10s:%lld%s, 60s:%lld%s, Lifetime Peak:%lld%s\n",
+		(LongType)RECENT_WINDOW / 1000,
+		peak / scale, unit, p50 / scale, unit, p95 / scale, unit,
+		(LongType)_ewma1s / scale, unit, (LongType)_ewma10s / scale, unit,
+		(LongType)_ewma60s / scale, unit, _peak / scale, unit);
+}
+
+void ResourceInfo::SerializeJson(OutputBuffer& OB) const
+{
+	OB.Append("{\"samples\":").AppendInt(_count);
+
+	LongType peak = 0, p50 = 0, p95 = 0;
+	if (GetRecent(RECENT_WINDOW, peak, p50, p95))
+	{
+		OB.Append(",\"recentPeak\":").AppendInt(peak)
+			.Append(",\"recentP50\":").AppendInt(p50)
+			.Append(",\"recentP95\":").AppendInt(p95);
+	}
+
+	OB.Append(",\"ewma1s\":").AppendInt((LongType)_ewma1s)
+		.Append(",\"ewma10s\":").AppendInt((LongType)_ewma10s)
+		.Append(",\"ewma60s\":").AppendInt((LongType)_ewma60s)
+		.Append(",\"peak\":").AppendInt(_peak)
+		.Append(",\"avg\":").AppendInt(_avg)
+		.Append('}');
+}
+
+// 依次为最近的峰值/P50/P95、1s/10s/60s移动平均、生命期峰值/平均值，共8列
+void ResourceInfo::SerializeCsv(OutputBuffer& OB) const
+{
+	LongType peak = 0, p50 = 0, p95 = 0;
+	if (GetRecent(RECENT_WINDOW, peak, p50, p95))
+	{
+		OB.Append(',').AppendInt(peak).Append(',').AppendInt(p50).Append(',').AppendInt(p95);
+	}
+	else
+	{
+		OB.Append(",,,");
+	}
+
+	OB.Append(',').AppendInt((LongType)_ewma1s)
+		.Append(',').AppendInt((LongType)_ewma10s)
+		.Append(',').AppendInt((LongType)_ewma60s)
+		.Append(',').AppendInt(_peak)
+		.Append(',').AppendInt(_avg);
+}
+
+ResourceStatistics::ResourceStatistics()
+	:_ioTime(0)
+	, _refCount(0)
+{
+	// 初始化统计资源信息
+	_Reset();
+
+	ResourceSampler::GetInstance()->Register(this);
 }
 
 void ResourceStatistics::StartStatistics()
 {
 	//
-	// ̲߳һεĳʹüͳơ
-	// һ߳̽ʱʼͳƣһ̳߳ʱ
-	// ֹͣͳơ
+	// 多个线程并行剖析一个代码段的场景下使用引用计数进行统计。
+	// 第一个线程进入剖析段时开始统计，最后一个线程出剖析段时
+	// 停止统计。
 	//
 	if (_refCount++ == 0)
 	{
-		unique_lock<std::mutex> lock(_lockMutex);
-		_condVariable.notify_one();
+		ResourceSampler::GetInstance()->Activate();
 	}
 }
 
 void ResourceStatistics::StopStatistics()
 {
-	if (_refCount > 0)
+	//
+	// 判断和递减必须是一次原子操作，否则两个线程同时退出时可能都看到1(重复停止)
+	// 或者都没有减到0(不停止)。引用计数为0时是没有开始的停止，不递减。
+	//
+	int refCount = _refCount.load();
+	do
 	{
-		--_refCount;
-		_lastKernelTime = -1;
-		_lastSystemTime = -1;
+		if (refCount <= 0)
+			return;
+	} while (!_refCount.compare_exchange_weak(refCount, refCount - 1));
+
+	if (refCount == 1)
+	{
+		ResourceSampler::GetInstance()->Deactivate();
 	}
 }
 
-const ResourceInfo& ResourceStatistics::GetCpuInfo()
+void ResourceStatistics::GetSnapshot(ResourceSnapshot& snapshot)
 {
-	return _cpuInfo;
+	// 采样线程在锁内更新统计信息，这里只在锁内复制
+	unique_lock<std::mutex> lock(ResourceSampler::GetInstance()->_lockMutex);
+	snapshot._cpuInfo = _cpuInfo;
+	snapshot._memoryInfo = _memoryInfo;
+	snapshot._ioCounters = _ioCounters;
+	snapshot._ioTime = _ioTime;
 }
 
-const ResourceInfo& ResourceStatistics::GetMemoryInfo()
+// 不支持的项保持-1
+static void AddIODelta(LongType& total, LongType end, LongType begin)
 {
-	return _memoryInfo;
+	if (end < 0 || begin < 0)
+	{
+		total = -1;
+		return;
+	}
+
+	if (total >= 0 && end > begin)
+		total += end - begin;
 }
 
-///////////////////////////////////////////////////
-// ResourceStatistics
+void IOCounters::AddDelta(const IOCounters& end, const IOCounters& begin)
+{
+	AddIODelta(_readBytes, end._readBytes, begin._readBytes);
+	AddIODelta(_writeBytes, end._writeBytes, begin._writeBytes);
+	AddIODelta(_readOps, end._readOps, begin._readOps);
+	AddIODelta(_writeOps, end._writeOps, begin._writeOps);
+	AddIODelta(_readDiskBytes, end._readDiskBytes, begin._readDiskBytes);
+	AddIODelta(_writeDiskBytes, end._writeDiskBytes, begin._writeDiskBytes);
+}
 
 static const int CPU_TIME_SLICE_UNIT = 100;
 
-void ResourceStatistics::_Statistics()
+// 计算CPU占用率
+LongType ResourceStatistics::_GetCpuUsageRate(const ResourceSample& sample)
+{
+	LongType cpuRate = -1;
+
+	// 1.如果是剖析段重新开始的第一次统计，则更新最近的内核时间和系统时间
+	if (_lastSystemTime == -1 && _lastKernelTime == -1)
+	{
+		_lastSystemTime = sample._systemTime;
+		_lastKernelTime = sample._kernelTime;
+		return cpuRate;
+	}
+
+	LongType systemTimeInterval = sample._systemTime - _lastSystemTime;
+	LongType kernelTimeInterval = sample._kernelTime - _lastKernelTime;
+
+	// 2.若耗费的系统时间值小于设定的时间片（CPU_TIME_SLICE_UNIT），则不计入统计。
+	if (systemTimeInterval > CPU_TIME_SLICE_UNIT)
+	{
+		cpuRate = kernelTimeInterval * 100 / systemTimeInterval;
+		cpuRate /= sample._cpuCount;
+
+		_lastSystemTime = sample._systemTime;
+		_lastKernelTime = sample._kernelTime;
+	}
+
+	return cpuRate;
+}
+
+// 重置最近的时间
+void ResourceStatistics::_Reset()
+{
+	_lastKernelTime = -1;
+	_lastSystemTime = -1;
+	_lastIOTime = -1;
+}
+
+// 更新统计信息
+void ResourceStatistics::_UpdateStatistics(const ResourceSample& sample)
+{
+	//
+	// 未在统计时重置最近的时间，下次开始统计时重新计算CPU占用率。
+	// 最近的时间只在采样线程中读写。
+	//
+	if (_refCount == 0)
+	{
+		_Reset();
+		return;
+	}
+
+	_cpuInfo.Update(_GetCpuUsageRate(sample), sample._systemTime);
+	_memoryInfo.Update(sample._memory, sample._systemTime);
+
+	//
+	// 读取IO计数失败时所有项为-1，跳过这次采样，下次成功采样的差值包含这段时间，
+	// 不能把累计值置为不支持。只有个别项不支持(始终为-1)时累计值才为-1。
+	//
+	if (sample._io._readBytes < 0)
+		return;
+
+	// 累计相邻两次采样之间的IO计数
+	if (_lastIOTime != -1)
+	{
+		_ioCounters.AddDelta(sample._io, _lastIOCounters);
+		_ioTime += sample._systemTime - _lastIOTime;
+	}
+
+	_lastIOCounters = sample._io;
+	_lastIOTime = sample._systemTime;
+}
+
+///////////////////////////////////////////////////
+// ResourceSampler
+
+ResourceSampler::ResourceSampler()
+	:_activeCount(0)
+{
+	// 初始化采样资源
+#ifdef _WIN32
+	_processHandle = ::GetCurrentProcess();
+#else
+	// 预先打开/proc下的文件，每次采样时只需pread读取
+	_statFd = ::open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+	_statmFd = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+	_ioFd = ::open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	_selfReadBytes = 0;
+	_selfReadOps = 0;
+	_clockTicks = ::sysconf(_SC_CLK_TCK);
+	_pageSize = ::sysconf(_SC_PAGESIZE);
+
+	if (_statFd == -1 || _statmFd == -1)
+	{
+		RECORD_ERROR_LOG("Open /proc/self Error");
+	}
+#endif
+	_cpuCount = _GetCpuCount();
+
+	// 成员初始化完成后再启动采样线程
+	_samplerThread = thread(&ResourceSampler::_Run, this);
+}
+
+void ResourceSampler::Register(ResourceStatistics* statistics)
+{
+	unique_lock<std::mutex> lock(_lockMutex);
+	_statisticsList.push_back(statistics);
+}
+
+void ResourceSampler::Activate()
+{
+	unique_lock<std::mutex> lock(_lockMutex);
+	if (_activeCount++ == 0)
+	{
+		_condVariable.notify_one();
+	}
+}
+
+void ResourceSampler::Deactivate()
 {
+	unique_lock<std::mutex> lock(_lockMutex);
+	--_activeCount;
+}
+
+void ResourceSampler::_Run()
+{
+	ResourceSample sample;
+
+	unique_lock<std::mutex> lock(_lockMutex);
 	while (1)
 	{
 		//
-		// δʼͳʱʹ
+		// 没有正在统计的资源统计段时，则使用条件变量阻塞。
+		// 阻塞前先重置各统计段最近的时间。
 		//
-		if (_refCount == 0)
+		if (_activeCount == 0)
 		{
-			unique_lock<std::mutex> lock(_lockMutex);
+			for (size_t i = 0; i < _statisticsList.size(); ++i)
+			{
+				_statisticsList[i]->_Reset();
+			}
+
 			_condVariable.wait(lock);
+			continue;
 		}
 
-		// ͳϢ
-		_UpdateStatistics();
+		// 采样时不持有锁，不阻塞剖析段的开始和结束
+		lock.unlock();
+		_Sample(sample);
+		lock.lock();
+
+		// 分发给所有资源统计段，未在统计的段只重置状态
+		for (size_t i = 0; i < _statisticsList.size(); ++i)
+		{
+			_statisticsList[i]->_UpdateStatistics(sample);
+		}
 
-		// ÿCPUʱƬԪͳһ
+		// 每个CPU时间片单元统计一次
+		lock.unlock();
 		this_thread::sleep_for(std::chrono::milliseconds(CPU_TIME_SLICE_UNIT));
+		lock.lock();
 	}
 }
 
+void ResourceSampler::_Sample(ResourceSample& sample)
+{
+	sample._systemTime = _GetSystemTime();
+	sample._kernelTime = _GetKernelTime();
+	sample._memory = _GetMemoryUsage();
+	_GetIOUsage(sample._io);
+	sample._cpuCount = _cpuCount;
+}
+
 #ifdef _WIN32
 // FILETIME->long long
 static LongType FileTimeToLongType(const FILETIME& fTime)
@@ -127,8 +444,8 @@ static LongType FileTimeToLongType(const FILETIME& fTime)
 	return time;
 }
 
-// ȡCPU
-int ResourceStatistics::_GetCpuCount()
+// 获取CPU个数
+int ResourceSampler::_GetCpuCount()
 {
 	SYSTEM_INFO info;
 	::GetSystemInfo(&info);
@@ -136,8 +453,8 @@ int ResourceStatistics::_GetCpuCount()
 	return info.dwNumberOfProcessors;
 }
 
-// ȡںʱ
-LongType ResourceStatistics::_GetKernelTime()
+// 获取内核时间
+LongType ResourceSampler::_GetKernelTime()
 {
 	FILETIME createTime;
 	FILETIME exitTime;
@@ -153,37 +470,14 @@ LongType ResourceStatistics::_GetKernelTime()
 	return (FileTimeToLongType(kernelTime) + FileTimeToLongType(userTime)) / 10000;
 }
 
-// ȡCPUռ
-LongType ResourceStatistics::_GetCpuUsageRate()
+// 获取系统时间
+LongType ResourceSampler::_GetSystemTime()
 {
-	LongType cpuRate = -1;
-
-	// 1.¿ʼĵһͳƣںʱϵͳʱ
-	if (_lastSystemTime == -1 && _lastKernelTime == -1)
-	{
-		_lastSystemTime = GetTickCount();
-		_lastKernelTime = _GetKernelTime();
-		return cpuRate;
-	}
-
-	LongType systemTimeInterval = GetTickCount() - _lastSystemTime;
-	LongType kernelTimeInterval = _GetKernelTime() - _lastKernelTime;
-
-	// 2.ķѵϵͳʱֵС趨ʱƬCPU_TIME_SLICE_UNIT򲻼ͳơ
-	if (systemTimeInterval > CPU_TIME_SLICE_UNIT)
-	{
-		cpuRate = kernelTimeInterval * 100 / systemTimeInterval;
-		cpuRate /= _cpuCount;
-
-		_lastSystemTime = GetTickCount();
-		_lastKernelTime = _GetKernelTime();
-	}
-
-	return cpuRate;
+	return GetTickCount();
 }
 
-// ȡڴʹϢ
-LongType ResourceStatistics::_GetMemoryUsage()
+// 获取内存使用信息
+LongType ResourceSampler::_GetMemoryUsage()
 {
 	PROCESS_MEMORY_COUNTERS PMC;
 	if (false == GetProcessMemoryInfo(_processHandle, &PMC, sizeof(PMC)))
@@ -194,56 +488,142 @@ LongType ResourceStatistics::_GetMemoryUsage()
 	return PMC.PagefileUsage;
 }
 
-// ȡIOʹϢ
-void ResourceStatistics::_GetIOUsage(LongType& readBytes, LongType& writeBytes)
+// 获取IO使用信息
+void ResourceSampler::_GetIOUsage(IOCounters& io)
 {
 	IO_COUNTERS IOCounter;
 	if (false == GetProcessIoCounters(_processHandle, &IOCounter))
 	{
 		RECORD_ERROR_LOG("GetProcessIoCounters Error");
+		io._readBytes = io._writeBytes = io._readOps = io._writeOps = -1;
+	}
+	else
+	{
+		io._readBytes = IOCounter.ReadTransferCount;
+		io._writeBytes = IOCounter.WriteTransferCount;
+		io._readOps = IOCounter.ReadOperationCount;
+		io._writeOps = IOCounter.WriteOperationCount;
 	}
 
-	readBytes = IOCounter.ReadTransferCount;
-	writeBytes = IOCounter.WriteTransferCount;
+	// Windows下没有区分实际读写存储设备的字节数
+	io._readDiskBytes = -1;
+	io._writeDiskBytes = -1;
 }
 
-// ͳϢ
-void ResourceStatistics::_UpdateStatistics()
+#else // Linux
+int ResourceSampler::_ReadProcFile(int fd, char* buf, int size)
 {
-	_cpuInfo.Update(_GetCpuUsageRate());
-	_memoryInfo.Update(_GetMemoryUsage());
+	if (fd == -1)
+		return 0;
+
+	// /proc下的文件每次从头读取都会得到最新的内容
+	int len = (int)::pread(fd, buf, size - 1, 0);
+	if (len < 0)
+	{
+		RECORD_ERROR_LOG("Read /proc/self Error");
+		len = 0;
+	}
+
+	buf[len] = '\0';
 
-	/*
-	LongType readBytes, writeBytes;
-	GetIOUsage(readBytes, writeBytes);
-	_readIOInfo.Update(readBytes);
-	_writeIOInfo.Update(writeBytes);
-	*/
+	// 采样自身的读取也会计入进程的IO计数
+	_selfReadBytes += len;
+	++_selfReadOps;
+
+	return len;
 }
 
-#else // Linux
-void ResourceStatistics::_UpdateStatistics()
+// 获取CPU个数
+int ResourceSampler::_GetCpuCount()
 {
-	char buf[1024] = { 0 };
-	char cmd[256] = { 0 };
-	sprintf(cmd, "ps -o pcpu,rss -p %d | sed 1,1d", _pid);
+	int cpuCount = (int)::sysconf(_SC_NPROCESSORS_ONLN);
+	return cpuCount > 0 ? cpuCount : 1;
+}
+
+// 获取内核时间(用户态+内核态)
+LongType ResourceSampler::_GetKernelTime()
+{
+	char buf[1024];
+	if (_ReadProcFile(_statFd, buf, sizeof(buf)) == 0)
+		return 0;
 
 	//
-	//  "ps"  ͨܵȡ ("pid" )  FILE* stream
-	// ո stream ȡbuf
-	// http://www.cnblogs.com/caosiyang/archive/2012/06/25/2560976.html
-	FILE *stream = ::popen(cmd, "r");
-	::fread(buf, sizeof (char), 1024, stream);
-	::pclose(stream);
+	// /proc/self/stat格式：pid (comm) state ppid ... utime stime ...
+	// comm中可能包含空格和括号，从最后一个')'之后开始解析，
+	// utime和stime是第14和15个字段。
+	//
+	const char* pos = strrchr(buf, ')');
+	if (pos == NULL)
+		return 0;
 
-	double cpu = 0.0;
-	int rss = 0;
-	sscanf(buf, "%lf %d", &cpu, &rss);
+	++pos;
+	for (int field = 3; field < 14 && *pos; ++field)
+	{
+		while (*pos == ' ')
+			++pos;
+		while (*pos && *pos != ' ')
+			++pos;
+	}
 
-	_cpuInfo.Update(cpu);
-	_memoryInfo.Update(rss);
+	char* end = NULL;
+	LongType utime = strtoll(pos, &end, 10);
+	LongType stime = strtoll(end, NULL, 10);
+
+	return (utime + stime) * 1000 / _clockTicks;
 }
-#endif
+
+// 获取系统时间
+LongType ResourceSampler::_GetSystemTime()
+{
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (LongType)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+// 获取内存使用信息(常驻内存)
+LongType ResourceSampler::_GetMemoryUsage()
+{
+	char buf[256];
+	if (_ReadProcFile(_statmFd, buf, sizeof(buf)) == 0)
+		return -1;
+
+	// /proc/self/statm格式：size resident shared ...，单位为页
+	long long size = 0, resident = 0;
+	if (sscanf(buf, "%lld %lld", &size, &resident) != 2)
+		return -1;
+
+	return resident * _pageSize;
+}
+
+// 获取IO使用信息
+void ResourceSampler::_GetIOUsage(IOCounters& io)
+{
+	io._readBytes = io._writeBytes = io._readOps = io._writeOps = -1;
+	io._readDiskBytes = io._writeDiskBytes = -1;
+
+	// 扣除的是本次读取之前采样自身的读取，本次读取在下次采样时扣除
+	LongType selfReadBytes = _selfReadBytes;
+	LongType selfReadOps = _selfReadOps;
+
+	char buf[512];
+	if (_ReadProcFile(_ioFd, buf, sizeof(buf)) == 0)
+		return;
+
+	// /proc/self/io格式：rchar、wchar、syscr、syscw、read_bytes、write_bytes...每行一项
+	long long rchar, wchar, syscr, syscw, readBytes, writeBytes;
+	if (sscanf(buf, "rchar: %lld wchar: %lld syscr: %lld syscw: %lld read_bytes: %lld write_bytes: %lld",
+		&rchar, &wchar, &syscr, &syscw, &readBytes, &writeBytes) != 6)
+		return;
+
+	io._readBytes = rchar - selfReadBytes;
+	io._writeBytes = wchar;
+	io._readOps = syscr - selfReadOps;
+	io._writeOps = syscw;
+	io._readDiskBytes = readBytes;
+	io._writeDiskBytes = writeBytes;
+}
+#endif // _WIN32
 
 //////////////////////////////////////////////////////////////////////
 // IPCMonitorServer
@@ -264,7 +644,7 @@ int GetProcessId()
 #ifdef _WIN32
 const char* SERVER_PIPE_NAME = "\\\\.\\Pipe\\PPServerPipeName";
 #else
-const char* SERVER_PIPE_NAME = "tmp/performance_profiler/_fifo";
+const char* SERVER_PIPE_NAME = "/tmp/performance_profiler_";
 #endif
 
 string GetServerPipeName()
@@ -276,15 +656,34 @@ string GetServerPipeName()
 	return name;
 }
 
+#ifndef _WIN32
+static void RemoveServerPipe()
+{
+	unlink(GetServerPipeName().c_str());
+}
+#endif
+
 IPCMonitorServer::IPCMonitorServer()
 	:_onMsgThread(&IPCMonitorServer::OnMessage, this)
 {
 	printf("%s IPC Monitor Server Start\n", GetServerPipeName().c_str());
 
+#ifndef _WIN32
+	// 进程退出时删除套接字文件
+	atexit(RemoveServerPipe);
+#endif
+
 	_cmdFuncsMap["state"] = GetState;
 	_cmdFuncsMap["save"] = Save;
 	_cmdFuncsMap["disable"] = Disable;
 	_cmdFuncsMap["enable"] = Enable;
+	_cmdFuncsMap["enable_section"] = EnableSection;
+	_cmdFuncsMap["disable_section"] = DisableSection;
+	_cmdFuncsMap["sample"] = SetSectionSampling;
+	_cmdFuncsMap["trace"] = Trace;
+	_cmdFuncsMap["report_interval"] = SetReportInterval;
+	_cmdFuncsMap["shared_memory"] = SetSharedMemory;
+	_cmdFuncsMap["report"] = Report;
 }
 
 void IPCMonitorServer::Start()
@@ -292,33 +691,40 @@ void IPCMonitorServer::Start()
 
 void IPCMonitorServer::OnMessage()
 {
-	const int IPC_BUF_LEN = 1024;
-	char msg[IPC_BUF_LEN] = { 0 };
 	IPCServer server(GetServerPipeName().c_str());
+	string cmd;
+	string args;
+	string reply;
 
 	while (1)
 	{
-		server.ReceiverMsg(msg, IPC_BUF_LEN);
-		printf("Receiver Cmd Msg: %s\n", msg);
+		// 监听失败(如没有权限创建套接字)时稍后重试，不空转
+		if (!server.ReceiveRequest(cmd, args))
+		{
+			this_thread::sleep_for(chrono::seconds(1));
+			continue;
+		}
 
-		string reply;
-		string cmd = msg;
+		printf("Receiver Cmd Msg: %s %s\n", cmd.c_str(), args.c_str());
+
+		// 回复可能很大(如完整的剖析报告)，分块发送，reply在多次请求之间复用
+		reply.clear();
 		CmdFuncMap::iterator it = _cmdFuncsMap.find(cmd);
 		if (it != _cmdFuncsMap.end())
 		{
 			CmdFunc func = it->second;
-			func(reply);
+			func(args, reply);
 		}
 		else
 		{
 			reply = "Invalid Command";
 		}
 
-		server.SendReplyMsg(reply.c_str(), reply.size());
+		server.SendReply(reply.data(), reply.size());
 	}
 }
 
-void IPCMonitorServer::GetState(string& reply)
+void IPCMonitorServer::GetState(const string& /*args*/, string& reply)
 {
 	reply += "State:";
 	int flag = ConfigManager::GetInstance()->GetOptions();
@@ -343,286 +749,3670 @@ void IPCMonitorServer::GetState(string& reply)
 	{
 		reply += "Save To File\n";
 	}
+
+	if (flag & PPCO_SAVE_TO_JSON)
+	{
+		reply += "Save To Json File\n";
+	}
+
+	if (flag & PPCO_SAVE_TO_CSV)
+	{
+		reply += "Save To Csv File\n";
+	}
+
+	if (flag & PPCO_SAVE_TO_SNAPSHOT)
+	{
+		reply += "Save To Snapshot File\n";
+	}
+
+	int interval = PerformanceReporter::GetInstance()->GetInterval();
+	if (interval > 0)
+	{
+		char buf[64];
+		sprintf(buf, "Report Interval: %ds\n", interval);
+		reply += buf;
+	}
+
+	interval = PerformancePublisher::GetInstance()->GetInterval();
+	if (interval > 0)
+	{
+		char buf[64];
+		sprintf(buf, "Shared Memory Interval: %dms\n", interval);
+		reply += buf;
+	}
+
+	// 资源统计段最近的资源信息
+	StringSaveAdapter SSA(reply);
+	PerformanceProfiler::GetInstance()->SerializeResourceState(SSA);
 }
 
-void IPCMonitorServer::Enable(string& reply)
+void IPCMonitorServer::Enable(const string& /*args*/, string& reply)
 {
 	ConfigManager::GetInstance()->SetOptions(PPCO_PROFILER | PPCO_SAVE_TO_FILE);
 
 	reply += "Enable Success";
 }
 
-void IPCMonitorServer::Disable(string& reply)
+void IPCMonitorServer::Disable(const string& /*args*/, string& reply)
 {
 	ConfigManager::GetInstance()->SetOptions(PPCO_NONE);
 
 	reply += "Disable Success";
 }
 
-void IPCMonitorServer::Save(string& reply)
-{
-	ConfigManager::GetInstance()->SetOptions(
-		ConfigManager::GetInstance()->GetOptions() | PPCO_SAVE_TO_FILE);
-	PerformanceProfiler::GetInstance()->OutPut();
-
-	reply += "Save Success";
-}
-
-//////////////////////////////////////////////////////////////
-// Ч
-
-//ȡ·ļ
-static string GetFileName(const string& path)
+void IPCMonitorServer::Save(const string& args, string& reply)
 {
-	char ch = '/';
+	// 没有参数时和原来一样打开保存到文件的选项并按选项输出
+	if (args.empty())
+	{
+		ConfigManager::GetInstance()->SetOptions(
+			ConfigManager::GetInstance()->GetOptions() | PPCO_SAVE_TO_FILE);
+		PerformanceProfiler::GetInstance()->OutPut();
 
-#ifdef _WIN32
-	ch = '\\';
-#endif
+		reply += "Save Success";
+		return;
+	}
 
-	size_t pos = path.rfind(ch);
-	if (pos == string::npos)
+	// 参数为报告格式text/json/csv/snapshot，只保存这一种格式，不修改选项
+	PP_REPORT_FORMAT format;
+	const char* fileName;
+	const char* mode = "w";
+	if (args == "text")
 	{
-		return path;
+		format = PPRF_TEXT;
+		fileName = "PerformanceProfilerReport.txt";
+	}
+	else if (args == "json")
+	{
+		format = PPRF_JSON;
+		fileName = "PerformanceProfilerReport.json";
+	}
+	else if (args == "csv")
+	{
+		format = PPRF_CSV;
+		fileName = "PerformanceProfilerReport.csv";
+	}
+	else if (args == "snapshot")
+	{
+		format = PPRF_SNAPSHOT;
+		fileName = "PerformanceProfilerReport.pps";
+		mode = "wb";
 	}
 	else
 	{
-		return path.substr(pos + 1);
+		reply += "Usage: save [text|json|csv|snapshot]";
+		return;
 	}
+
+	FileSaveAdapter FSA(fileName, mode);
+	PerformanceProfiler::GetInstance()->OutPutReport(FSA, format);
+
+	reply += "Save Success";
 }
 
-// PerformanceNode
-PerformanceNode::PerformanceNode(const char* fileName, const char* function,
-	int line, const char* desc)
-	:_fileName(GetFileName(fileName))
-	,_function(function)
-	,_line(line)
-	,_desc(desc)
-{}
+void IPCMonitorServer::Report(const string& args, string& reply)
+{
+	// 参数为报告格式text/json/csv/snapshot，默认为text，报告直接回复给工具，不写文件
+	PP_REPORT_FORMAT format = PPRF_TEXT;
+	if (args == "json")
+		format = PPRF_JSON;
+	else if (args == "csv")
+		format = PPRF_CSV;
+	else if (args == "snapshot")
+		format = PPRF_SNAPSHOT;
+	else if (!args.empty() && args != "text")
+	{
+		reply += "Usage: report [text|json|csv|snapshot]";
+		return;
+	}
 
-bool PerformanceNode::operator<(const PerformanceNode& p) const
+	StringSaveAdapter SSA(reply);
+	PerformanceProfiler::GetInstance()->OutPutReport(SSA, format);
+}
+
+void IPCMonitorServer::EnableSection(const string& args, string& reply)
 {
-	if (_line > p._line)
-		return false;
+	if (args.empty())
+	{
+		reply += "Usage: enable_section <desc | file:line>";
+		return;
+	}
 
-	if (_line < p._line)
-		return true;
+	char buf[64];
+	int count = ConfigManager::GetInstance()->SetSectionEnable(args, true);
+	sprintf(buf, "Enable Section Success, Match:%d", count);
 
-	if (_fileName > p._fileName)
-		return false;
-	
-	if (_fileName < p._fileName)
-		return true;
+	reply += buf;
+}
 
-	if (_function > p._function)
-		return false;
+void IPCMonitorServer::DisableSection(const string& args, string& reply)
+{
+	if (args.empty())
+	{
+		reply += "Usage: disable_section <desc | file:line>";
+		return;
+	}
 
-	if (_function < p._function)
-		return true;
+	char buf[64];
+	int count = ConfigManager::GetInstance()->SetSectionEnable(args, false);
+	sprintf(buf, "Disable Section Success, Match:%d", count);
 
-	return false;
+	reply += buf;
 }
 
-bool PerformanceNode::operator == (const PerformanceNode& p) const
+void IPCMonitorServer::SetSectionSampling(const string& args, string& reply)
 {
-	return _fileName == p._fileName
-		&&_function == p._function
-		&&_line == p._line;
+	//
+	// 参数格式为"采样方式 采样率 剖析段"，采样方式为none/every/random/interval，
+	// interval的采样率为时间间隔(微秒)。
+	//
+	char modeStr[16] = { 0 };
+	long long rate = 0;
+	int keyPos = 0;
+	if (sscanf(args.c_str(), "%15s %lld %n", modeStr, &rate, &keyPos) < 2
+		|| keyPos == 0 || keyPos >= (int)args.size())
+	{
+		reply += "Usage: sample <none|every|random|interval> <rate> <desc | file:line>";
+		return;
+	}
+
+	int mode = PPSM_NONE;
+	if (strcmp(modeStr, "every") == 0)
+		mode = PPSM_EVERY_N;
+	else if (strcmp(modeStr, "random") == 0)
+		mode = PPSM_RANDOM;
+	else if (strcmp(modeStr, "interval") == 0)
+		mode = PPSM_INTERVAL;
+	else if (strcmp(modeStr, "none") != 0)
+	{
+		reply += "Invalid Sample Mode";
+		return;
+	}
+
+	char buf[64];
+	int count = ConfigManager::GetInstance()->SetSectionSampling(
+		args.substr(keyPos), mode, rate);
+	sprintf(buf, "Set Sampling Success, Match:%d", count);
+
+	reply += buf;
 }
 
-void PerformanceNode::Serialize(SaveAdapter& SA) const
+void IPCMonitorServer::Trace(const string& /*args*/, string& reply)
 {
-	SA.Save("FileName:%s, Fuction:%s, Line:%d\n",
-		_fileName.c_str(), _function.c_str(), _line);
+	PerformanceProfiler::GetInstance()->OutPutTrace();
+
+	reply += "Trace Success";
 }
 
-///////////////////////////////////////////////////////////////
-//PerformanceProfilerSection
-void PerformanceProfilerSection::Serialize(SaveAdapter& SA)
+void IPCMonitorServer::SetReportInterval(const string& args, string& reply)
 {
-	// ܵü0ʾβƥ
-	if (_totalRef)
-		SA.Save("Performance Profiler Not Match!\n");
-
-	// лЧͳϢ
-	auto costTimeIt = _costTimeMap.begin();
-	for (; costTimeIt != _costTimeMap.end(); ++costTimeIt)
+	// 参数为时间间隔(秒)，0表示停止周期报告
+	int seconds = 0;
+	if (sscanf(args.c_str(), "%d", &seconds) != 1 || seconds < 0)
 	{
-		LongType callCount = _callCountMap[costTimeIt->first];
-		SA.Save("Thread Id:%d, Cost Time:%.2f, Call Count:%d\n",
-			 costTimeIt->first, 
-			(double)costTimeIt->second / CLOCKS_PER_SEC,
-			callCount);
+		reply += "Usage: report_interval <seconds>";
+		return;
 	}
 
-	SA.Save("Total Cost Time:%.2f, Total Call Count:%d\n",
-		(double)_totalCostTime / CLOCKS_PER_SEC, _totalCallCount);
+	PerformanceReporter::GetInstance()->SetInterval(seconds);
 
-	// лԴͳϢ
-	if (_rsStatistics)
+	reply += "Set Report Interval Success";
+}
+
+void IPCMonitorServer::SetSharedMemory(const string& args, string& reply)
+{
+	// 参数为发布的时间间隔(毫秒)，0表示停止发布
+	int milliseconds = 0;
+	if (sscanf(args.c_str(), "%d", &milliseconds) != 1 || milliseconds < 0)
 	{
-		ResourceInfo cpuInfo = _rsStatistics->GetCpuInfo();
-		SA.Save("Cpu Peak:%lld%%, Avg:%lld%%\n", cpuInfo._peak, cpuInfo._avg);
+		reply += "Usage: shared_memory <milliseconds>";
+		return;
+	}
 
-		ResourceInfo memoryInfo = _rsStatistics->GetMemoryInfo();
-		SA.Save("Memory Peak:%lldK, Avg:%lldK\n", memoryInfo._peak / 1024, memoryInfo._avg / 1024);
+	if (!PerformancePublisher::GetInstance()->SetInterval(milliseconds))
+	{
+		reply += "Create Shared Memory Failed";
+		return;
 	}
+
+	reply += "Set Shared Memory Success";
 }
 
 //////////////////////////////////////////////////////////////
-// PerformanceProfiler
-PerformanceProfilerSection* PerformanceProfiler::CreateSection(const char* fileName,
-	const char* function, int line, const char* extraDesc, bool isStatistics)
+// 周期报告
+
+// 周期报告文件
+static const char* INTERVAL_REPORT_FILE = "PerformanceProfilerInterval.txt";
+
+PerformanceReporter::PerformanceReporter()
+	:_interval(0)
+	, _changed(false)
+	, _maxFileSize(10 * 1024 * 1024)
+	, _maxFileCount(5)
+{}
+
+void PerformanceReporter::SetInterval(int seconds)
 {
-	PerformanceProfilerSection* section = NULL;
-	PerformanceNode node(fileName, function, line, extraDesc);
+	unique_lock<std::mutex> lock(_lockMutex);
+	_interval = seconds;
+	_changed = true;
 
-	unique_lock<mutex> Lock(_mutex);
-	auto it = _ppMap.find(node);
-	if (it != _ppMap.end())
+	// 第一次开启周期报告时才启动报告线程
+	if (seconds > 0 && !_reporterThread.joinable())
 	{
-		section = it->second;
+		_reporterThread = thread(&PerformanceReporter::_Run, this);
 	}
-	else
+
+	_condVariable.notify_one();
+}
+
+int PerformanceReporter::GetInterval()
+{
+	unique_lock<std::mutex> lock(_lockMutex);
+	return _interval;
+}
+
+void PerformanceReporter::SetRotation(LongType maxFileSize, int maxFileCount)
+{
+	unique_lock<std::mutex> lock(_lockMutex);
+	_maxFileSize = maxFileSize;
+	_maxFileCount = maxFileCount;
+}
+
+void PerformanceReporter::_Run()
+{
+	chrono::steady_clock::time_point deadline;
+
+	unique_lock<std::mutex> lock(_lockMutex);
+	while (1)
 	{
-		section = new PerformanceProfilerSection;
-		if (isStatistics)
+		// 时间间隔修改后从现在开始重新计时
+		if (_changed)
 		{
-			section->_rsStatistics = new ResourceStatistics();
+			_changed = false;
+			deadline = chrono::steady_clock::now() + chrono::seconds(_interval);
 		}
-		_ppMap[node] = section;
-	}
 
-	return section;
+		// 停止周期报告时阻塞等待
+		if (_interval <= 0)
+		{
+			_condVariable.wait(lock);
+			continue;
+		}
+
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (now < deadline)
+		{
+			_condVariable.wait_until(lock, deadline);
+			continue;
+		}
+
+		// 按固定的节拍报告，报告耗时超过一个周期时从现在重新计时
+		deadline += chrono::seconds(_interval);
+		if (deadline <= now)
+			deadline = now + chrono::seconds(_interval);
+
+		// 输出报告时不持有锁，不阻塞修改配置
+		LongType maxFileSize = _maxFileSize;
+		int maxFileCount = _maxFileCount;
+		lock.unlock();
+		_Report(maxFileSize, maxFileCount);
+		lock.lock();
+	}
 }
 
-void PerformanceProfilerSection::Begin(int threadId)
+void PerformanceReporter::_Report(LongType maxFileSize, int maxFileCount)
 {
-	unique_lock<mutex> Lock(_mutex);
+	if (!ConfigManager::IsProfilerEnable())
+		return;
 
-	// µôͳ
-	++_callCountMap[threadId];
+	{
+		FileSaveAdapter FSA(INTERVAL_REPORT_FILE, "a");
+		PerformanceProfiler::GetInstance()->OutPutInterval(FSA);
+	}
 
-	// ü == 0 ʱ¶οʼʱͳƣݹ⡣
-	auto& refCount = _refCountMap[threadId];
-	if (refCount == 0)
+	struct stat st;
+	if (stat(INTERVAL_REPORT_FILE, &st) == 0 && st.st_size >= maxFileSize)
 	{
-		_beginTimeMap[threadId] = clock();
+		_Rotate(maxFileCount);
+	}
+}
 
-		// ʼԴͳ
-		if (_rsStatistics)
-		{
-			_rsStatistics->StartStatistics();
-		}
+//
+// 轮转报告文件：删除最旧的文件，.N-1->.N ... .1->.2，当前文件->.1，
+// 下一次报告写到新的文件中。
+//
+void PerformanceReporter::_Rotate(int maxFileCount)
+{
+	// 不保留旧文件
+	if (maxFileCount <= 0)
+	{
+		remove(INTERVAL_REPORT_FILE);
+		return;
 	}
 
-	// οʼüͳ
-	++refCount;
-	++_totalRef;
-	++_totalCallCount;
+	char from[256];
+	char to[256];
+
+	sprintf(to, "%s.%d", INTERVAL_REPORT_FILE, maxFileCount);
+	remove(to);
+
+	for (int i = maxFileCount - 1; i >= 0; --i)
+	{
+		if (i > 0)
+			sprintf(from, "%s.%d", INTERVAL_REPORT_FILE, i);
+		else
+			strcpy(from, INTERVAL_REPORT_FILE);
+
+		sprintf(to, "%s.%d", INTERVAL_REPORT_FILE, i + 1);
+		rename(from, to);
+	}
 }
 
-void PerformanceProfilerSection::End(int threadId)
+//////////////////////////////////////////////////////////////
+// 共享内存发布
+
+PerformancePublisher::PerformancePublisher()
+	:_interval(0)
+	, _header(NULL)
+	, _size(0)
+#ifdef _WIN32
+	, _hMapping(NULL)
+#endif
+{}
+
+bool PerformancePublisher::SetInterval(int milliseconds)
 {
-	unique_lock<mutex> Lock(_mutex);
+	unique_lock<std::mutex> lock(_lockMutex);
 
-	// ü
-	LongType refCount = --_refCountMap[threadId];
-	--_totalRef;
+	// 第一次开启发布时创建共享内存区并启动发布线程，创建失败时不修改时间间隔
+	if (milliseconds > 0 && _header == NULL && !_Create())
+	{
+		return false;
+	}
 
-	//
-	// ü <= 0 ʱλʱ䡣
-	// ݹβƥ
-	//
-	if (refCount <= 0)
+	if (milliseconds > 0 && !_publisherThread.joinable())
 	{
-		auto it = _beginTimeMap.find(threadId);
-		if (it != _beginTimeMap.end())
-		{
-			LongType costTime = clock() - it->second;
-			if (refCount == 0)
-				_costTimeMap[threadId] += costTime;
-			else
-				_costTimeMap[threadId] = costTime;
+		_publisherThread = thread(&PerformancePublisher::_Run, this);
+	}
+
+	_interval = milliseconds;
+	_condVariable.notify_one();
+
+	return true;
+}
 
-			_totalCostTime += costTime;
+int PerformancePublisher::GetInterval()
+{
+	unique_lock<std::mutex> lock(_lockMutex);
+	return _interval;
+}
+
+void PerformancePublisher::_Run()
+{
+	unique_lock<std::mutex> lock(_lockMutex);
+	while (1)
+	{
+		// 停止发布时阻塞等待
+		if (_interval <= 0)
+		{
+			_condVariable.wait(lock);
+			continue;
 		}
 
-		// ֹͣԴͳ
-		if (_rsStatistics)
+		// 发布时不持有锁，不阻塞修改配置
+		lock.unlock();
+		if (ConfigManager::IsProfilerEnable())
 		{
-			_rsStatistics->StopStatistics();
+			PerformanceProfiler::GetInstance()->OutPutSharedMemory(*_header);
 		}
+		lock.lock();
+
+		_condVariable.wait_for(lock, chrono::milliseconds(_interval));
 	}
 }
 
-PerformanceProfiler::PerformanceProfiler()
+bool PerformancePublisher::_Create()
 {
-	// ʱ
-	atexit(OutPut);
+	char name[64];
+	GetSharedMemoryName(GetProcessId(), name);
+	size_t size = GetSharedMemorySize(PP_SHARED_MEMORY_CAPACITY);
+	void* data = NULL;
 
-	time(&_beginTime);
+#ifdef _WIN32
+	_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		0, (DWORD)size, name);
+	if (_hMapping == NULL)
+	{
+		RECORD_ERROR_LOG("Create Shared Memory Error");
+		return false;
+	}
 
-	IPCMonitorServer::GetInstance()->Start();
-}
+	data = MapViewOfFile(_hMapping, FILE_MAP_WRITE, 0, 0, size);
+	if (data == NULL)
+	{
+		RECORD_ERROR_LOG("Map Shared Memory Error");
+		CloseHandle(_hMapping);
+		_hMapping = NULL;
+		return false;
+	}
+#else
+	// 同一个进程id的旧共享内存区是已退出的进程遗留的
+	shm_unlink(name);
 
-void PerformanceProfiler::OutPut()
-{
-	int flag = ConfigManager::GetInstance()->GetOptions();
-	if (flag & PPCO_SAVE_TO_CONSOLE)
+	// 和IPC套接字一样只允许同一用户访问，剖析段名字不暴露给其他用户
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
 	{
-		ConsoleSaveAdapter CSA;
-		PerformanceProfiler::GetInstance()->_OutPut(CSA);
+		RECORD_ERROR_LOG("Create Shared Memory Error");
+		return false;
 	}
 
-	if (flag & PPCO_SAVE_TO_FILE)
+	if (ftruncate(fd, size) < 0
+		|| (data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
 	{
-		FileSaveAdapter FSA("PerformanceProfilerReport.txt");
-		PerformanceProfiler::GetInstance()->_OutPut(FSA);
+		RECORD_ERROR_LOG("Map Shared Memory Error");
+		close(fd);
+		shm_unlink(name);
+		return false;
 	}
+
+	close(fd);
+#endif
+
+	// 新建的共享内存全为0，记录数为0，只需初始化文件头
+	PerformanceSharedMemoryHeader* header = (PerformanceSharedMemoryHeader*)data;
+	header->_version = PP_SHARED_MEMORY_VERSION;
+	header->_headerSize = (unsigned int)GetSharedMemoryHeaderSize();
+	header->_sectionSize = sizeof(PerformanceSharedMemorySection);
+	header->_capacity = PP_SHARED_MEMORY_CAPACITY;
+	header->_processId = GetProcessId();
+	header->_beginTime = time(NULL);
+
+	// 其他字段初始化完成后才写入标识，读取方读到标识即可使用
+	atomic_thread_fence(memory_order_release);
+	memcpy(header->_magic, PP_SHARED_MEMORY_MAGIC, sizeof(header->_magic));
+
+	_header = header;
+	_size = size;
+
+	atexit(_Destroy);
+
+	return true;
 }
 
-bool PerformanceProfiler::CompareByCallCount(PerformanceProfilerMap::iterator lhs,
-	PerformanceProfilerMap::iterator rhs)
+void PerformancePublisher::_Destroy()
 {
-	return lhs->second->_totalCallCount > rhs->second->_totalCallCount;
+#ifndef _WIN32
+	// 映射在进程退出时释放，这里只删除名字，避免/dev/shm中遗留
+	char name[64];
+	GetSharedMemoryName(GetProcessId(), name);
+	shm_unlink(name);
+#endif
 }
 
-bool PerformanceProfiler::CompareByCostTime(PerformanceProfilerMap::iterator lhs,
-	PerformanceProfilerMap::iterator rhs)
+//////////////////////////////////////////////////////////////
+// 堆内存分配统计
+
+// 当前线程暂停统计的嵌套层数
+static PP_THREAD_LOCAL int tlsAllocTrackerPause = 0;
+
+PerformanceAllocTracker::Pause::Pause()
 {
-	return lhs->second->_totalCostTime > rhs->second->_totalCostTime;
+	++tlsAllocTrackerPause;
 }
 
-void PerformanceProfiler::_OutPut(SaveAdapter& SA)
+PerformanceAllocTracker::Pause::~Pause()
 {
-	SA.Save("=============Performance Profiler Report==============\n\n");
-	SA.Save("Profiler Begin Time: %s\n", ctime(&_beginTime));
+	--tlsAllocTrackerPause;
+}
 
-	unique_lock<mutex> Lock(_mutex);
+bool PerformanceAllocTracker::IsTracking()
+{
+	return ConfigManager::HasOption(PPCO_ALLOC) && tlsAllocTrackerPause == 0;
+}
 
-	vector<PerformanceProfilerMap::iterator> vInfos;
-	auto it = _ppMap.begin();
-	for (; it != _ppMap.end(); ++it)
+void PerformanceAllocTracker::OnAlloc(size_t size)
+{
+	if (!IsTracking())
+		return;
+
+	// 没有剖析上下文时当前线程一定不在剖析段中，这里不能注册上下文(会分配内存)
+	PerformanceThreadContext* context = PerformanceThreadContext::FindCurrent();
+	if (context == NULL)
+		return;
+
+	PerformanceFrame* frame = context->GetTopFrame();
+	if (frame == NULL)
+		return;
+
+	PerformanceThreadSlot* slot = frame->_slot;
+	SlotAdd(slot->_allocCount, 1);
+	SlotAdd(slot->_allocBytes, size);
+
+	slot->_liveBytes += size;
+	if (slot->_liveBytes > slot->_peakLiveBytes.load(memory_order_relaxed))
 	{
-		vInfos.push_back(it);
+		slot->_peakLiveBytes.store(slot->_liveBytes, memory_order_relaxed);
 	}
+}
 
-	// 
-	int flag = ConfigManager::GetInstance()->GetOptions();
-	if (flag & PPCO_SAVE_BY_COST_TIME)
-		sort(vInfos.begin(), vInfos.end(), CompareByCostTime);
-	else if (flag & PPCO_SAVE_BY_CALL_COUNT)
-		sort(vInfos.begin(), vInfos.end(), CompareByCallCount);
+void PerformanceAllocTracker::OnFree(size_t size)
+{
+	if (!IsTracking())
+		return;
 
-	for (int index = 0; index < vInfos.size(); ++index)
+	PerformanceThreadContext* context = PerformanceThreadContext::FindCurrent();
+	if (context == NULL)
+		return;
+
+	PerformanceFrame* frame = context->GetTopFrame();
+	if (frame == NULL)
+		return;
+
+	// 释放的可能是剖析段外分配的内存，未释放字节数可能为负
+	PerformanceThreadSlot* slot = frame->_slot;
+	SlotAdd(slot->_freeBytes, size);
+	slot->_liveBytes -= size;
+}
+
+#ifdef PERFORMANCE_PROFILER_TRACK_ALLOC
+#ifdef _WIN32
+//
+// Windows下替换全局operator new/delete，用_msize获取块大小
+//
+void* operator new(size_t size)
+{
+	void* ptr = malloc(size ? size : 1);
+	if (ptr == NULL)
+		throw std::bad_alloc();
+
+	if (PerformanceAllocTracker::IsTracking())
+		PerformanceAllocTracker::OnAlloc(_msize(ptr));
+
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* ptr) throw()
+{
+	if (ptr)
 	{
-		SA.Save("NO%d. Description:%s\n", index + 1, vInfos[index]->first._desc.c_str());
-		vInfos[index]->first.Serialize(SA);
-		vInfos[index]->second->Serialize(SA);
-		SA.Save("\n");
+		if (PerformanceAllocTracker::IsTracking())
+			PerformanceAllocTracker::OnFree(_msize(ptr));
+
+		free(ptr);
 	}
+}
 
-	SA.Save("==========================end========================\n\n");
+void operator delete[](void* ptr) throw()
+{
+	operator delete(ptr);
 }
+#else
+//
+// Linux下通过符号插入替换malloc/free系列函数，转调glibc的实现，
+// operator new/delete最终也调用malloc/free。统计时用malloc_usable_size获取块大小。
+// ps：mmap/brk等直接向内核申请的内存不经过这些函数，不会统计。
+//
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* ptr, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void* __libc_valloc(size_t size);
+	void* __libc_pvalloc(size_t size);
+	void __libc_free(void* ptr);
+
+	// 统计新分配的块
+	static inline void* TrackAlloc(void* ptr)
+	{
+		if (ptr && PerformanceAllocTracker::IsTracking())
+			PerformanceAllocTracker::OnAlloc(malloc_usable_size(ptr));
 
+		return ptr;
+	}
+
+	void* malloc(size_t size)
+	{
+		return TrackAlloc(__libc_malloc(size));
+	}
+
+	void* calloc(size_t count, size_t size)
+	{
+		return TrackAlloc(__libc_calloc(count, size));
+	}
+
+	void* realloc(void* ptr, size_t size)
+	{
+		if (!PerformanceAllocTracker::IsTracking())
+			return __libc_realloc(ptr, size);
+
+		size_t oldSize = ptr ? malloc_usable_size(ptr) : 0;
+		void* newPtr = __libc_realloc(ptr, size);
+		if (newPtr || size == 0)
+		{
+			if (oldSize)
+				PerformanceAllocTracker::OnFree(oldSize);
+			if (newPtr)
+				PerformanceAllocTracker::OnAlloc(malloc_usable_size(newPtr));
+		}
+
+		return newPtr;
+	}
+
+	void* memalign(size_t alignment, size_t size)
+	{
+		return TrackAlloc(__libc_memalign(alignment, size));
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size)
+	{
+		return memalign(alignment, size);
+	}
+
+	int posix_memalign(void** result, size_t alignment, size_t size)
+	{
+		if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+			return EINVAL;
+
+		void* ptr = memalign(alignment, size);
+		if (ptr == NULL)
+			return ENOMEM;
+
+		*result = ptr;
+		return 0;
+	}
+
+	void* valloc(size_t size)
+	{
+		return TrackAlloc(__libc_valloc(size));
+	}
+
+	void* pvalloc(size_t size)
+	{
+		return TrackAlloc(__libc_pvalloc(size));
+	}
+
+	void free(void* ptr)
+	{
+		if (ptr)
+		{
+			if (PerformanceAllocTracker::IsTracking())
+				PerformanceAllocTracker::OnFree(malloc_usable_size(ptr));
+
+			__libc_free(ptr);
+		}
+	}
+}
+#endif // _WIN32
+#endif // PERFORMANCE_PROFILER_TRACK_ALLOC
+
+//////////////////////////////////////////////////////////////
+// 性能计数器
+
+atomic<int> PerformanceCounterGroup::_sAvailableMask(0);
+
+#ifdef _WIN32
+PerformanceCounterGroup::PerformanceCounterGroup()
+{
+	_sAvailableMask.fetch_or(1 << PPCT_CYCLES, memory_order_relaxed);
+}
+
+PerformanceCounterGroup::~PerformanceCounterGroup()
+{}
+
+void PerformanceCounterGroup::Read(LongType values[PPCT_COUNT])
+{
+	for (int i = 0; i < PPCT_COUNT; ++i)
+	{
+		values[i] = 0;
+	}
+
+	ULONG64 cycles = 0;
+	QueryThreadCycleTime(GetCurrentThread(), &cycles);
+	values[PPCT_CYCLES] = (LongType)cycles;
+}
+#else
+// 软件计数器组
+static const int SOFTWARE_COUNTERS[] = { PPCT_PAGE_FAULTS, PPCT_CONTEXT_SWITCHES, PPCT_CPU_MIGRATIONS };
+static const int SOFTWARE_CONFIGS[] = { PERF_COUNT_SW_PAGE_FAULTS,
+	PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS };
+
+// 硬件计数器组，第一个CPU周期数为组长
+static const int HARDWARE_COUNTERS[] = { PPCT_CYCLES, PPCT_INSTRUCTIONS,
+	PPCT_CACHE_MISSES, PPCT_BRANCH_MISSES };
+static const int HARDWARE_CONFIGS[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+PerformanceCounterGroup::PerformanceCounterGroup()
+	:_rusage(false)
+{
+	_OpenGroup(GROUP_SOFTWARE, PERF_TYPE_SOFTWARE, SOFTWARE_COUNTERS, SOFTWARE_CONFIGS,
+		sizeof(SOFTWARE_COUNTERS) / sizeof(SOFTWARE_COUNTERS[0]));
+	_OpenGroup(GROUP_HARDWARE, PERF_TYPE_HARDWARE, HARDWARE_COUNTERS, HARDWARE_CONFIGS,
+		sizeof(HARDWARE_COUNTERS) / sizeof(HARDWARE_COUNTERS[0]));
+
+	// perf事件不可用(内核不支持或perf_event_paranoid限制)时退化为getrusage
+	if (_groupFds[GROUP_SOFTWARE] == -1)
+	{
+		_rusage = true;
+		_sAvailableMask.fetch_or((1 << PPCT_PAGE_FAULTS) | (1 << PPCT_CONTEXT_SWITCHES),
+			memory_order_relaxed);
+	}
+}
+
+PerformanceCounterGroup::~PerformanceCounterGroup()
+{
+	for (size_t i = 0; i < _memberFds.size(); ++i)
+	{
+		::close(_memberFds[i]);
+	}
+}
+
+void PerformanceCounterGroup::_OpenGroup(int group, int type,
+	const int* counters, const int* configs, int count)
+{
+	_groupFds[group] = -1;
+	_groupSizes[group] = 0;
+
+	for (int i = 0; i < count; ++i)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = (type == PERF_TYPE_HARDWARE);
+		attr.exclude_hv = 1;
+
+		// pid = 0, cpu = -1只统计所属线程
+		int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1,
+			_groupFds[group], PERF_FLAG_FD_CLOEXEC);
+		if (fd == -1)
+		{
+			// 组长打开失败则整组不可用，组员打开失败(如硬件计数器不足)只跳过该计数器
+			if (_groupFds[group] == -1)
+				return;
+
+			continue;
+		}
+
+		if (_groupFds[group] == -1)
+			_groupFds[group] = fd;
+
+		_memberFds.push_back(fd);
+		_groupCounters[group][_groupSizes[group]++] = counters[i];
+		_sAvailableMask.fetch_or(1 << counters[i], memory_order_relaxed);
+	}
+}
+
+void PerformanceCounterGroup::Read(LongType values[PPCT_COUNT])
+{
+	for (int i = 0; i < PPCT_COUNT; ++i)
+	{
+		values[i] = 0;
+	}
+
+	// PERF_FORMAT_GROUP格式：计数器个数，然后按加入组的顺序排列的计数值
+	for (int group = 0; group < GROUP_COUNT; ++group)
+	{
+		if (_groupFds[group] == -1)
+			continue;
+
+		unsigned long long buf[1 + PPCT_COUNT];
+		if (::read(_groupFds[group], buf, sizeof(buf)) <= 0)
+			continue;
+
+		for (unsigned long long i = 0; i < buf[0] && (int)i < _groupSizes[group]; ++i)
+		{
+			values[_groupCounters[group][i]] = (LongType)buf[1 + i];
+		}
+	}
+
+	if (_rusage)
+	{
+		struct rusage usage;
+		if (getrusage(RUSAGE_THREAD, &usage) == 0)
+		{
+			values[PPCT_PAGE_FAULTS] = usage.ru_minflt + usage.ru_majflt;
+			values[PPCT_CONTEXT_SWITCHES] = usage.ru_nvcsw + usage.ru_nivcsw;
+		}
+	}
+}
+#endif // _WIN32
+
+//////////////////////////////////////////////////////////////
+// 输出缓冲区
+
+// 缓冲区初始大小
+static const size_t OUTPUT_BUFFER_INIT_SIZE = 64 * 1024;
+
+// 两位十进制数字表，每次除以100输出两位
+static const char DIGIT_PAIRS[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+void OutputBuffer::_Grow(size_t len)
+{
+	PerformanceAllocTracker::Pause pause;
+
+	size_t size = _buffer.size() * 2;
+	if (size < OUTPUT_BUFFER_INIT_SIZE)
+		size = OUTPUT_BUFFER_INIT_SIZE;
+
+	if (size < _size + len)
+		size = _size + len;
+
+	_buffer.resize(size);
+}
+
+int OutputBuffer::Save(char* format, ...)
+{
+	va_list argPtr;
+	int cnt;
+
+	// 先按剩余空间格式化，空间不足时扩容后重新格式化
+	char* pos = _Reserve(256);
+	size_t avail = _buffer.size() - _size;
+
+	va_start(argPtr, format);
+	cnt = vsnprintf(pos, avail, format, argPtr);
+	va_end(argPtr);
+
+	if (cnt < 0)
+		return 0;
+
+	if ((size_t)cnt >= avail)
+	{
+		pos = _Reserve(cnt + 1);
+
+		va_start(argPtr, format);
+		vsnprintf(pos, cnt + 1, format, argPtr);
+		va_end(argPtr);
+	}
+
+	_size += cnt;
+	return cnt;
+}
+
+int OutputBuffer::Write(const char* data, size_t len)
+{
+	Append(data, len);
+	return (int)len;
+}
+
+OutputBuffer& OutputBuffer::AppendInt(LongType value)
+{
+	// 从后往前生成数字，最多20位加符号
+	char buf[24];
+	char* end = buf + sizeof(buf);
+	char* pos = end;
+
+	unsigned long long num = value < 0
+		? 0 - (unsigned long long)value : (unsigned long long)value;
+
+	while (num >= 100)
+	{
+		unsigned index = (unsigned)(num % 100) * 2;
+		num /= 100;
+		*--pos = DIGIT_PAIRS[index + 1];
+		*--pos = DIGIT_PAIRS[index];
+	}
+
+	if (num >= 10)
+	{
+		unsigned index = (unsigned)num * 2;
+		*--pos = DIGIT_PAIRS[index + 1];
+		*--pos = DIGIT_PAIRS[index];
+	}
+	else
+	{
+		*--pos = (char)('0' + num);
+	}
+
+	if (value < 0)
+		*--pos = '-';
+
+	return Append(pos, end - pos);
+}
+
+OutputBuffer& OutputBuffer::AppendDouble(double value, int precision)
+{
+	static const LongType SCALES[] = { 1, 10, 100, 1000, 10000, 100000,
+		1000000, 10000000, 100000000, 1000000000 };
+
+	if (precision < 0)
+		precision = 0;
+	if (precision > 9)
+		precision = 9;
+
+	// 整数部分超出double的精确整数范围、非数和无穷大时交给printf处理
+	double absValue = fabs(value);
+	if (!(absValue < 9e15))
+	{
+		Save("%.*f", precision, value);
+		return *this;
+	}
+
+	//
+	// 整数部分和小数部分分开计算，按默认的舍入模式(四舍六入五成双)取整，
+	// 和printf的结果保持一致。小数部分放大时的舍入误差可能造成假的"五"，
+	// 用fma求出精确误差后修正。
+	//
+	LongType scale = SCALES[precision];
+	double intPart = precision ? floor(absValue) : nearbyint(absValue);
+	double fracPart = absValue - intPart;
+	double scaled = fracPart * scale;
+	double rounded = nearbyint(scaled);
+	if (scaled - floor(scaled) == 0.5)
+	{
+		double error = fma(fracPart, (double)scale, -scaled);
+		if (error > 0)
+			rounded = ceil(scaled);
+		else if (error < 0)
+			rounded = floor(scaled);
+	}
+
+	LongType integer = (LongType)intPart;
+	LongType fraction = precision ? (LongType)rounded : 0;
+	if (fraction >= scale)
+	{
+		++integer;
+		fraction -= scale;
+	}
+
+	if (signbit(value))
+		Append('-');
+
+	AppendInt(integer);
+	if (precision)
+	{
+		// 小数部分按位数补齐前导0
+		char buf[16];
+		for (int i = precision - 1; i >= 0; --i)
+		{
+			buf[i] = (char)('0' + fraction % 10);
+			fraction /= 10;
+		}
+
+		Append('.');
+		Append(buf, precision);
+	}
+
+	return *this;
+}
+
+// 转义JSON字符串
+static string JsonEscape(const string& str)
+{
+	string escaped;
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		unsigned char ch = str[i];
+		if (ch == '"' || ch == '\\')
+		{
+			escaped += '\\';
+			escaped += ch;
+		}
+		else if (ch < 0x20)
+		{
+			char buf[8];
+			sprintf(buf, "\\u%04x", ch);
+			escaped += buf;
+		}
+		else
+		{
+			escaped += ch;
+		}
+	}
+
+	return escaped;
+}
+
+// 转义CSV字段，包含逗号、引号和换行时用引号括起来，引号写两次
+static string CsvEscape(const string& str)
+{
+	if (str.find_first_of(",\"\r\n") == string::npos)
+		return str;
+
+	string escaped = "\"";
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		if (str[i] == '"')
+			escaped += '"';
+
+		escaped += str[i];
+	}
+
+	escaped += '"';
+	return escaped;
+}
+
+// 追加JSON对象的整数成员","key":value
+static void AppendJsonField(OutputBuffer& OB, const char* key, LongType value)
+{
+	OB.Append(",\"").Append(key).Append("\":").AppendInt(value);
+}
+
+// 追加一列CSV整数
+static void AppendCsvField(OutputBuffer& OB, LongType value)
+{
+	OB.Append(',').AppendInt(value);
+}
+
+// 追加count个空的CSV列
+static void AppendCsvEmpty(OutputBuffer& OB, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		OB.Append(',');
+	}
+}
+
+//////////////////////////////////////////////////////////////
+// 代码段效率剖析
+
+//获取路径中最后的文件名。
+static string GetFileName(const string& path)
+{
+	char ch = '/';
+
+#ifdef _WIN32
+	ch = '\\';
+#endif
+
+	size_t pos = path.rfind(ch);
+	if (pos == string::npos)
+	{
+		return path;
+	}
+	else
+	{
+		return path.substr(pos + 1);
+	}
+}
+
+// 获取剖析节点的"文件名:行号"
+static string GetFileLine(const PerformanceNode& node)
+{
+	char lineStr[16];
+	sprintf(lineStr, ":%d", node._line);
+
+	return node._fileName + lineStr;
+}
+
+// PerformanceNode
+PerformanceNode::PerformanceNode(const char* fileName, const char* function,
+	int line, const char* desc)
+	:_fileName(GetFileName(fileName))
+	,_function(function)
+	,_line(line)
+	,_desc(desc)
+{}
+
+bool PerformanceNode::operator<(const PerformanceNode& p) const
+{
+	if (_line > p._line)
+		return false;
+
+	if (_line < p._line)
+		return true;
+
+	if (_fileName > p._fileName)
+		return false;
+	
+	if (_fileName < p._fileName)
+		return true;
+
+	if (_function > p._function)
+		return false;
+
+	if (_function < p._function)
+		return true;
+
+	return false;
+}
+
+bool PerformanceNode::operator == (const PerformanceNode& p) const
+{
+	return _fileName == p._fileName
+		&&_function == p._function
+		&&_line == p._line;
+}
+
+void PerformanceNode::Serialize(OutputBuffer& OB) const
+{
+	OB.Append("FileName:").Append(_fileName)
+		.Append(", Fuction:").Append(_function)
+		.Append(", Line:").AppendInt(_line).Append('\n');
+}
+
+void PerformanceNode::SerializeJson(OutputBuffer& OB) const
+{
+	OB.Append("\"description\":\"").Append(JsonEscape(_desc))
+		.Append("\",\"file\":\"").Append(JsonEscape(_fileName))
+		.Append("\",\"function\":\"").Append(JsonEscape(_function))
+		.Append("\",\"line\":").AppendInt(_line);
+}
+
+void PerformanceNode::SerializeCsv(OutputBuffer& OB) const
+{
+	OB.Append(CsvEscape(_desc)).Append(',')
+		.Append(CsvEscape(_fileName)).Append(',')
+		.Append(CsvEscape(_function)).Append(',')
+		.AppendInt(_line);
+}
+
+///////////////////////////////////////////////////////////////
+// TimeEngine
+
+int TimeEngine::_source = PPTS_MONOTONIC;
+double TimeEngine::_nanosecondsPerTick = 1.0;
+
+// TSC校准时长(毫秒)
+static const int TSC_CALIBRATE_TIME = 20;
+
+LongType TimeEngine::_GetMonotonicTicks()
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (LongType)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+LongType TimeEngine::GetThreadCpuTime()
+{
+#ifdef _WIN32
+	FILETIME createTime;
+	FILETIME exitTime;
+	FILETIME kernelTime;
+	FILETIME userTime;
+	if (false == GetThreadTimes(GetCurrentThread(),
+		&createTime, &exitTime, &kernelTime, &userTime))
+	{
+		return 0;
+	}
+
+	// 单位为100纳秒
+	return (FileTimeToLongType(kernelTime) + FileTimeToLongType(userTime)) * 100;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (LongType)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// CPUID.80000007H:EDX[8]表示TSC不变
+bool TimeEngine::_IsInvariantTsc()
+{
+#if defined(PP_HAS_RDTSC) && defined(_WIN32)
+	int info[4] = { 0 };
+	__cpuid(info, 0x80000000);
+	if ((unsigned int)info[0] < 0x80000007)
+		return false;
+
+	__cpuid(info, 0x80000007);
+	return (info[3] & (1 << 8)) != 0;
+#elif defined(PP_HAS_RDTSC)
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+		return false;
+
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+void TimeEngine::Init(int source)
+{
+	// 单调时钟的计数单位
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	double monotonicNanosecondsPerTick = 1000000000.0 / frequency.QuadPart;
+#else
+	double monotonicNanosecondsPerTick = 1.0;
+#endif
+
+	_source = PPTS_MONOTONIC;
+	_nanosecondsPerTick = monotonicNanosecondsPerTick;
+
+#ifdef PP_HAS_RDTSC
+	if (source == PPTS_TSC || (source == PPTS_AUTO && _IsInvariantTsc()))
+	{
+		// 和单调时钟对比，校准一次TSC计数到纳秒的换算
+		LongType beginTicks = _GetMonotonicTicks();
+		LongType beginTsc = (LongType)__rdtsc();
+
+		this_thread::sleep_for(std::chrono::milliseconds(TSC_CALIBRATE_TIME));
+
+		LongType endTicks = _GetMonotonicTicks();
+		LongType endTsc = (LongType)__rdtsc();
+
+		if (endTsc > beginTsc)
+		{
+			_nanosecondsPerTick = (endTicks - beginTicks) * monotonicNanosecondsPerTick
+				/ (endTsc - beginTsc);
+			_source = PPTS_TSC;
+		}
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////
+// PerformanceHistogram
+
+// 最高位1的位置
+static int HighestBit(unsigned long long value)
+{
+#if defined(_WIN32) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return index;
+#elif defined(_WIN32)
+	unsigned long index;
+	if (_BitScanReverse(&index, (unsigned long)(value >> 32)))
+		return index + 32;
+
+	_BitScanReverse(&index, (unsigned long)value);
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+int PerformanceHistogram::GetBucketIndex(LongType value)
+{
+	if (value < SUB_BUCKET_COUNT)
+		return value < 0 ? 0 : (int)value;
+
+	int bit = HighestBit(value);
+	if (bit > MAX_BIT)
+		return BUCKET_COUNT - 1;
+
+	//
+	// 最高位为bit的值落在[2^bit, 2^(bit+1))区间，按最高位之后的SUB_BUCKET_BITS位
+	// 线性分桶，区间编号从1开始(0号区间为小于SUB_BUCKET_COUNT的值)。
+	//
+	int shift = bit - SUB_BUCKET_BITS;
+	int subIndex = (int)((value >> shift) & (SUB_BUCKET_COUNT - 1));
+
+	return (shift + 1) * SUB_BUCKET_COUNT + subIndex;
+}
+
+LongType PerformanceHistogram::GetBucketValue(int index)
+{
+	if (index < SUB_BUCKET_COUNT)
+		return index;
+
+	int shift = index / SUB_BUCKET_COUNT - 1;
+	int subIndex = index % SUB_BUCKET_COUNT;
+	LongType lower = (LongType)(SUB_BUCKET_COUNT + subIndex) << shift;
+
+	return lower + ((1LL << shift) >> 1);
+}
+
+///////////////////////////////////////////////////////////////
+// PerformanceThreadContext
+
+// 当前线程的剖析上下文
+static PP_THREAD_LOCAL PerformanceThreadContext* tlsThreadContext = NULL;
+
+// 按缓存行对齐分配内存，槽位块不会和其他线程的数据共享缓存行
+static void* AlignedMalloc(size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, 64);
+#else
+	void* ptr = NULL;
+	if (posix_memalign(&ptr, 64, size) != 0)
+		return NULL;
+
+	return ptr;
+#endif
+}
+
+static void AlignedFree(void* ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+//
+// 线程退出回调，注销当前线程的剖析上下文。
+// Linux下使用pthread线程键的析构函数，Windows下使用纤程局部存储的回调，
+// __thread/__declspec(thread)变量本身没有析构。
+//
+#ifdef _WIN32
+static DWORD tlsThreadExitKey = FLS_OUT_OF_INDEXES;
+
+static VOID WINAPI OnThreadExit(PVOID context)
+#else
+static pthread_key_t tlsThreadExitKey;
+static bool tlsThreadExitKeyCreated = false;
+
+static void OnThreadExit(void* context)
+#endif
+{
+	if (context == NULL)
+		return;
+
+	// 计数器fd属于退出的线程，不等合并就关闭
+	PerformanceThreadContext* threadContext = (PerformanceThreadContext*)context;
+	threadContext->CloseCounterGroup();
+
+	tlsThreadContext = NULL;
+	PerformanceProfiler::GetInstance()->UnregisterThreadContext(threadContext);
+}
+
+// 注册当前线程的退出回调，调用时持有线程上下文锁
+static void SetThreadExitCallback(PerformanceThreadContext* context)
+{
+#ifdef _WIN32
+	if (tlsThreadExitKey == FLS_OUT_OF_INDEXES)
+		tlsThreadExitKey = FlsAlloc(OnThreadExit);
+
+	if (tlsThreadExitKey != FLS_OUT_OF_INDEXES)
+		FlsSetValue(tlsThreadExitKey, context);
+#else
+	if (!tlsThreadExitKeyCreated)
+		tlsThreadExitKeyCreated = (pthread_key_create(&tlsThreadExitKey, OnThreadExit) == 0);
+
+	if (tlsThreadExitKeyCreated)
+		pthread_setspecific(tlsThreadExitKey, context);
+#endif
+}
+
+PerformanceThreadContext::PerformanceThreadContext(int threadId)
+	:_threadId(threadId)
+	, _random(((unsigned long long)threadId << 32) ^ TimeEngine::GetTicks() ^ 0x9E3779B97F4A7C15ULL)
+	, _depth(0)
+	, _droppedFrames(0)
+	, _traceBuffer(NULL)
+	, _counterGroup(NULL)
+{
+	for (int i = 0; i < SLOT_CHUNK_COUNT; ++i)
+	{
+		_chunks[i].store(NULL, memory_order_relaxed);
+	}
+}
+
+PerformanceThreadContext::~PerformanceThreadContext()
+{
+	for (int i = 0; i < SLOT_CHUNK_COUNT; ++i)
+	{
+		PerformanceThreadSlot* chunk = _chunks[i].load(memory_order_relaxed);
+		if (chunk == NULL)
+			continue;
+
+		for (int j = 0; j < SLOT_CHUNK_SIZE; ++j)
+		{
+			PerformanceThreadSlot& slot = chunk[j];
+			delete slot._histogram.load(memory_order_relaxed);
+			delete slot._counters.load(memory_order_relaxed);
+
+			PerformanceEdge* edge = slot._edges.load(memory_order_relaxed);
+			while (edge)
+			{
+				PerformanceEdge* next = edge->_next;
+				delete edge;
+				edge = next;
+			}
+
+			slot.~PerformanceThreadSlot();
+		}
+
+		AlignedFree(chunk);
+	}
+
+	delete _traceBuffer.load(memory_order_relaxed);
+	delete _counterGroup;
+}
+
+PerformanceThreadContext* PerformanceThreadContext::GetCurrent()
+{
+	if (tlsThreadContext == NULL)
+	{
+		tlsThreadContext = PerformanceProfiler::GetInstance()->RegisterThreadContext();
+	}
+
+	return tlsThreadContext;
+}
+
+PerformanceThreadContext* PerformanceThreadContext::FindCurrent()
+{
+	return tlsThreadContext;
+}
+
+PerformanceThreadSlot* PerformanceThreadContext::GetSlot(int sectionId)
+{
+	int chunkIndex = sectionId / SLOT_CHUNK_SIZE;
+	if (chunkIndex >= SLOT_CHUNK_COUNT)
+		return NULL;
+
+	// 只有所属线程分配槽位块，所以这里不存在竞争
+	PerformanceThreadSlot* chunk = _chunks[chunkIndex].load(memory_order_relaxed);
+	if (chunk == NULL)
+	{
+		PerformanceAllocTracker::Pause pause;
+		void* ptr = AlignedMalloc(sizeof(PerformanceThreadSlot)* SLOT_CHUNK_SIZE);
+		if (ptr == NULL)
+			return NULL;
+
+		chunk = (PerformanceThreadSlot*)ptr;
+		for (int i = 0; i < SLOT_CHUNK_SIZE; ++i)
+		{
+			new(chunk + i) PerformanceThreadSlot;
+		}
+
+		// 发布槽位块，保证读线程看到的是初始化完成的槽位
+		_chunks[chunkIndex].store(chunk, memory_order_release);
+	}
+
+	return chunk + sectionId % SLOT_CHUNK_SIZE;
+}
+
+PerformanceThreadSlot* PerformanceThreadContext::FindSlot(int sectionId) const
+{
+	int chunkIndex = sectionId / SLOT_CHUNK_SIZE;
+	if (chunkIndex >= SLOT_CHUNK_COUNT)
+		return NULL;
+
+	PerformanceThreadSlot* chunk = _chunks[chunkIndex].load(memory_order_acquire);
+	if (chunk == NULL)
+		return NULL;
+
+	return chunk + sectionId % SLOT_CHUNK_SIZE;
+}
+
+PerformanceCounterGroup* PerformanceThreadContext::GetCounterGroup()
+{
+	if (_counterGroup == NULL)
+	{
+		PerformanceAllocTracker::Pause pause;
+		_counterGroup = new PerformanceCounterGroup;
+	}
+
+	return _counterGroup;
+}
+
+//
+// 合并槽位中的累计统计值，引用计数、采样状态等只对所属线程有意义的状态不合并。
+// 边和直方图不存在时分配，合并后的上下文只在持有线程上下文锁时修改。
+//
+void PerformanceThreadContext::Merge(const PerformanceThreadContext& other)
+{
+	for (int i = 0; i < SLOT_CHUNK_COUNT; ++i)
+	{
+		const PerformanceThreadSlot* chunk = other._chunks[i].load(memory_order_relaxed);
+		if (chunk == NULL)
+			continue;
+
+		for (int j = 0; j < SLOT_CHUNK_SIZE; ++j)
+		{
+			const PerformanceThreadSlot& from = chunk[j];
+			if (from._callCount.load(memory_order_relaxed) == 0)
+				continue;
+
+			PerformanceThreadSlot* to = GetSlot(i * SLOT_CHUNK_SIZE + j);
+			if (to == NULL)
+				return;
+
+			SlotWriteBegin(to);
+			SlotAdd(to->_costTime, from._costTime.load(memory_order_relaxed));
+			SlotAdd(to->_callCount, from._callCount.load(memory_order_relaxed));
+			SlotAdd(to->_entryCount, from._entryCount.load(memory_order_relaxed));
+			SlotAdd(to->_sampleCount, from._sampleCount.load(memory_order_relaxed));
+			to->_sampleSquare.store(to->_sampleSquare.load(memory_order_relaxed)
+				+ from._sampleSquare.load(memory_order_relaxed), memory_order_relaxed);
+			SlotAdd(to->_cpuTime, from._cpuTime.load(memory_order_relaxed));
+			SlotAdd(to->_cpuWallTime, from._cpuWallTime.load(memory_order_relaxed));
+			SlotAdd(to->_allocCount, from._allocCount.load(memory_order_relaxed));
+			SlotAdd(to->_allocBytes, from._allocBytes.load(memory_order_relaxed));
+			SlotAdd(to->_freeBytes, from._freeBytes.load(memory_order_relaxed));
+			if (from._peakLiveBytes.load(memory_order_relaxed) > to->_peakLiveBytes.load(memory_order_relaxed))
+				to->_peakLiveBytes.store(from._peakLiveBytes.load(memory_order_relaxed), memory_order_relaxed);
+
+			const PerformanceHistogram* histogram = from._histogram.load(memory_order_relaxed);
+			if (histogram)
+			{
+				PerformanceHistogram* toHistogram = to->_histogram.load(memory_order_relaxed);
+				if (toHistogram == NULL)
+				{
+					toHistogram = new PerformanceHistogram;
+					to->_histogram.store(toHistogram, memory_order_release);
+					to->_minCostTime.store(from._minCostTime.load(memory_order_relaxed), memory_order_relaxed);
+					to->_maxCostTime.store(from._maxCostTime.load(memory_order_relaxed), memory_order_relaxed);
+				}
+
+				for (int index = 0; index < PerformanceHistogram::BUCKET_COUNT; ++index)
+				{
+					toHistogram->Add(index, histogram->GetCount(index));
+				}
+
+				if (from._minCostTime.load(memory_order_relaxed) < to->_minCostTime.load(memory_order_relaxed))
+					to->_minCostTime.store(from._minCostTime.load(memory_order_relaxed), memory_order_relaxed);
+				if (from._maxCostTime.load(memory_order_relaxed) > to->_maxCostTime.load(memory_order_relaxed))
+					to->_maxCostTime.store(from._maxCostTime.load(memory_order_relaxed), memory_order_relaxed);
+			}
+
+			const PerformanceSectionCounters* counters = from._counters.load(memory_order_relaxed);
+			if (counters)
+			{
+				PerformanceSectionCounters* toCounters = to->_counters.load(memory_order_relaxed);
+				if (toCounters == NULL)
+				{
+					toCounters = new PerformanceSectionCounters;
+					to->_counters.store(toCounters, memory_order_release);
+				}
+
+				for (int index = 0; index < PPCT_COUNT; ++index)
+				{
+					SlotAdd(toCounters->_values[index], counters->_values[index].load(memory_order_relaxed));
+				}
+				SlotAdd(toCounters->_count, counters->_count.load(memory_order_relaxed));
+			}
+
+			const PerformanceEdge* edge = from._edges.load(memory_order_relaxed);
+			for (; edge; edge = edge->_next)
+			{
+				PerformanceEdge* toEdge = to->_edges.load(memory_order_relaxed);
+				while (toEdge && toEdge->_parentNode != edge->_parentNode)
+				{
+					toEdge = toEdge->_next;
+				}
+
+				if (toEdge == NULL)
+				{
+					toEdge = new PerformanceEdge(edge->_parentNode, edge->_node,
+						to->_edges.load(memory_order_relaxed));
+					to->_edges.store(toEdge, memory_order_release);
+				}
+
+				SlotAdd(toEdge->_callCount, edge->_callCount.load(memory_order_relaxed));
+				SlotAdd(toEdge->_inclusiveTime, edge->_inclusiveTime.load(memory_order_relaxed));
+				SlotAdd(toEdge->_exclusiveTime, edge->_exclusiveTime.load(memory_order_relaxed));
+			}
+			SlotWriteEnd(to);
+		}
+	}
+
+	SlotAdd(_droppedFrames, other._droppedFrames.load(memory_order_relaxed));
+}
+
+void PerformanceThreadContext::CloseCounterGroup()
+{
+	PerformanceAllocTracker::Pause pause;
+	delete _counterGroup;
+	_counterGroup = NULL;
+}
+
+void PerformanceThreadContext::Trace(int sectionId, int type)
+{
+	PerformanceTraceBuffer* buffer = _traceBuffer.load(memory_order_relaxed);
+	if (buffer == NULL)
+	{
+		PerformanceAllocTracker::Pause pause;
+		buffer = new PerformanceTraceBuffer;
+		_traceBuffer.store(buffer, memory_order_release);
+	}
+
+	buffer->Record(sectionId, type);
+}
+
+void PerformanceTraceBuffer::Read(vector<PerformanceTraceEvent>& events) const
+{
+	LongType end = _head.load(memory_order_acquire);
+	LongType begin = end > EVENT_COUNT ? end - EVENT_COUNT : 0;
+
+	for (LongType index = begin; index < end; ++index)
+	{
+		const Event& event = _events[index & (EVENT_COUNT - 1)];
+		LongType sequence = event._sequence.load(memory_order_acquire);
+
+		PerformanceTraceEvent traceEvent;
+		LongType info = event._info.load(memory_order_relaxed);
+		traceEvent._time = event._time.load(memory_order_relaxed);
+		traceEvent._sectionId = (int)(info >> 1);
+		traceEvent._type = (int)(info & 1);
+
+		//
+		// 读取过程中所属线程可能继续写入，覆盖了最早的事件。
+		// 顺序号不是第index个事件写完后的值，或者复制后顺序号变了，说明事件被覆盖，丢弃。
+		//
+		atomic_thread_fence(memory_order_acquire);
+		if (sequence != (index / EVENT_COUNT + 1) * 2
+			|| sequence != event._sequence.load(memory_order_relaxed))
+			continue;
+
+		events.push_back(traceEvent);
+	}
+}
+
+void PerformanceThreadContext::PushFrame(int sectionId, PerformanceThreadSlot* slot, bool timed)
+{
+	//
+	// 栈满一般是剖析段只有开始没有结束，丢弃整个栈重新记录，
+	// 否则之后所有剖析段的调用关系都不再统计。被丢弃帧的结束找不到对应的帧，会被忽略。
+	//
+	if (_depth >= MAX_FRAME_DEPTH)
+	{
+		SlotAdd(_droppedFrames, _depth);
+		_depth = 0;
+	}
+
+	PerformanceFrame& frame = _frames[_depth];
+	frame._sectionId = sectionId;
+	frame._slot = slot;
+	frame._childTime = 0;
+	frame._edge = NULL;
+	frame._node = -1;
+	frame._beginTime = 0;
+	if (timed)
+	{
+		int parentNode = _depth > 0 ? _frames[_depth - 1]._node : -1;
+		frame._edge = _FindEdge(slot, parentNode, sectionId);
+		frame._node = frame._edge ? frame._edge->_node : -1;
+		frame._beginTime = TimeEngine::GetTicks();
+	}
+
+	++_depth;
+}
+
+PerformanceEdge* PerformanceThreadContext::_FindEdge(PerformanceThreadSlot* slot,
+	int parentNode, int sectionId)
+{
+	PerformanceEdge* edge = slot->_lastEdge;
+	if (edge && edge->_parentNode == parentNode)
+		return edge;
+
+	edge = slot->_edges.load(memory_order_relaxed);
+	while (edge && edge->_parentNode != parentNode)
+	{
+		edge = edge->_next;
+	}
+
+	// 当前线程第一次经过这条调用路径，向剖析器获取全局的调用路径节点
+	if (edge == NULL)
+	{
+		int node = PerformanceProfiler::GetInstance()->GetCallPathNode(parentNode, sectionId);
+
+		PerformanceAllocTracker::Pause pause;
+		edge = new PerformanceEdge(parentNode, node, slot->_edges.load(memory_order_relaxed));
+		slot->_edges.store(edge, memory_order_release);
+	}
+
+	slot->_lastEdge = edge;
+	return edge;
+}
+
+void PerformanceThreadContext::PopFrame(int sectionId, bool outermost)
+{
+	//
+	// 从栈顶向下查找对应的帧，中间没有结束的剖析段(首尾不匹配)直接丢弃，
+	// 找不到对应的帧说明是没有开始的结束，忽略。
+	//
+	int index = _depth - 1;
+	while (index >= 0 && _frames[index]._sectionId != sectionId)
+	{
+		--index;
+	}
+
+	if (index < 0)
+		return;
+
+	if (index < _depth - 1)
+	{
+		SlotAdd(_droppedFrames, _depth - 1 - index);
+	}
+
+	PerformanceFrame& frame = _frames[index];
+	_depth = index;
+
+	PerformanceEdge* edge = frame._edge;
+	if (edge == NULL)
+		return;
+
+	LongType costTime = TimeEngine::GetTicks() - frame._beginTime;
+	if (index > 0)
+	{
+		_frames[index - 1]._childTime += costTime;
+	}
+
+	//
+	// 自身时间每次都统计，包含时间只在剖析段最外层退出时统计，
+	// 避免递归时重复计算。
+	//
+	SlotAdd(edge->_callCount, 1);
+	SlotAdd(edge->_exclusiveTime, costTime - frame._childTime);
+	if (outermost)
+	{
+		SlotAdd(edge->_inclusiveTime, costTime);
+	}
+}
+
+///////////////////////////////////////////////////////////////
+//PerformanceProfilerSection
+void PerformanceProfilerSection::ApplyConfig(const SectionConfig& config)
+{
+	_enable.store(config._enable, memory_order_relaxed);
+
+	LongType rate = config._sampleRate > 0 ? config._sampleRate : 1;
+	if (config._sampleMode == PPSM_INTERVAL)
+	{
+		// 采样时间间隔由微秒转换为时钟计数
+		rate = TimeEngine::NanosecondsToTicks(rate * 1000);
+	}
+
+	_sampleRate.store(rate, memory_order_relaxed);
+	_sampleMode.store(config._sampleMode, memory_order_relaxed);
+}
+
+// 合并统计时栈上保存的直方图个数，超出时使用vector
+static const size_t MERGE_HISTOGRAM_COUNT = 16;
+
+// 读取槽位快照的最大重读次数
+static const int SNAPSHOT_MAX_RETRY = 16;
+
+void PerformanceProfilerSection::Statistics(const vector<PerformanceThreadContext*>& contexts,
+	PerformanceSectionStatistics& statistics) const
+{
+	double estimateVariance = 0;	// 估算值的方差
+	const PerformanceHistogram* histograms[MERGE_HISTOGRAM_COUNT];	// 待合并的直方图
+	vector<const PerformanceHistogram*> moreHistograms;
+	size_t histogramCount = 0;
+
+	for (size_t i = 0; i < contexts.size(); ++i)
+	{
+		const PerformanceThreadSlot* slot = contexts[i]->FindSlot(_id);
+		if (slot == NULL)
+			continue;
+
+		//
+		// 按顺序锁读取一致的统计值快照，所属线程正在更新时重读。
+		// 重读多次仍不一致时(所属线程频繁进出剖析段)使用最后一次读到的值。
+		//
+		PerformanceThreadStatistics threadStatistics;
+		threadStatistics._threadId = contexts[i]->GetThreadId();
+		LongType refCount = 0;
+		LongType minCostTime = 0;
+		LongType maxCostTime = 0;
+		double sampleSquare = 0;
+		for (int retry = 0;; ++retry)
+		{
+			unsigned int sequence = slot->_sequence.load(memory_order_acquire);
+			threadStatistics._costTime = slot->_costTime.load(memory_order_relaxed);
+			threadStatistics._callCount = slot->_callCount.load(memory_order_relaxed);
+			threadStatistics._entryCount = slot->_entryCount.load(memory_order_relaxed);
+			threadStatistics._sampleCount = slot->_sampleCount.load(memory_order_relaxed);
+			threadStatistics._cpuTime = slot->_cpuTime.load(memory_order_relaxed);
+			threadStatistics._cpuWallTime = slot->_cpuWallTime.load(memory_order_relaxed);
+			refCount = slot->_refCount.load(memory_order_relaxed);
+			minCostTime = slot->_minCostTime.load(memory_order_relaxed);
+			maxCostTime = slot->_maxCostTime.load(memory_order_relaxed);
+			sampleSquare = slot->_sampleSquare.load(memory_order_relaxed);
+
+			atomic_thread_fence(memory_order_acquire);
+			if (((sequence & 1) == 0 && sequence == slot->_sequence.load(memory_order_relaxed))
+				|| retry >= SNAPSHOT_MAX_RETRY)
+				break;
+		}
+
+		// 该线程没有进入过这个剖析段
+		if (threadStatistics._callCount == 0 && refCount == 0)
+			continue;
+
+		statistics._threads.push_back(threadStatistics);
+		statistics._totalCostTime += threadStatistics._costTime;
+		statistics._totalCallCount += threadStatistics._callCount;
+		statistics._totalRef += refCount;
+		statistics._totalEntryCount += threadStatistics._entryCount;
+		statistics._totalSampleCount += threadStatistics._sampleCount;
+		statistics._totalCpuTime += threadStatistics._cpuTime;
+		statistics._totalCpuWallTime += threadStatistics._cpuWallTime;
+
+		// 合并内存分配统计
+		statistics._totalAllocCount += slot->_allocCount.load(memory_order_relaxed);
+		statistics._totalAllocBytes += slot->_allocBytes.load(memory_order_relaxed);
+		statistics._totalFreeBytes += slot->_freeBytes.load(memory_order_relaxed);
+		statistics._peakLiveBytes = max(statistics._peakLiveBytes,
+			slot->_peakLiveBytes.load(memory_order_relaxed));
+
+		// 合并性能计数器
+		const PerformanceSectionCounters* counters = slot->_counters.load(memory_order_acquire);
+		if (counters)
+		{
+			for (int index = 0; index < PPCT_COUNT; ++index)
+			{
+				statistics._counters[index] += counters->_values[index].load(memory_order_relaxed);
+			}
+
+			statistics._counterCount += counters->_count.load(memory_order_relaxed);
+		}
+
+		// 按父调用路径节点合并调用树的边
+		const PerformanceEdge* edge = slot->_edges.load(memory_order_acquire);
+		for (; edge; edge = edge->_next)
+		{
+			size_t index = 0;
+			for (; index < statistics._edges.size(); ++index)
+			{
+				if (statistics._edges[index]._parentNode == edge->_parentNode)
+					break;
+			}
+
+			if (index == statistics._edges.size())
+			{
+				PerformanceEdgeStatistics edgeStatistics = { edge->_parentNode, edge->_node, 0, 0, 0 };
+				statistics._edges.push_back(edgeStatistics);
+			}
+
+			statistics._edges[index]._callCount += edge->_callCount.load(memory_order_relaxed);
+			statistics._edges[index]._inclusiveTime += edge->_inclusiveTime.load(memory_order_relaxed);
+			statistics._edges[index]._exclusiveTime += edge->_exclusiveTime.load(memory_order_relaxed);
+		}
+
+		// 延迟直方图在确定最小/最大花费时间之后再合并
+		const PerformanceHistogram* histogram = slot->_histogram.load(memory_order_acquire);
+		if (histogram)
+		{
+			// 第一个直方图直接取它的最小/最大值，花费时间可能全为0个计时单位
+			if (histogramCount == 0)
+			{
+				statistics._minCostTime = minCostTime;
+				statistics._maxCostTime = maxCostTime;
+			}
+			else
+			{
+				if (minCostTime < statistics._minCostTime)
+					statistics._minCostTime = minCostTime;
+				if (maxCostTime > statistics._maxCostTime)
+					statistics._maxCostTime = maxCostTime;
+			}
+
+			if (histogramCount < MERGE_HISTOGRAM_COUNT)
+				histograms[histogramCount] = histogram;
+			else
+				moreHistograms.push_back(histogram);
+			++histogramCount;
+		}
+
+		//
+		// 按采样结果估算花费时间：估算值 = 计时总和 * 进入次数 / 计时次数，
+		// 估算值的方差 = N^2 * S^2 / n * (1 - n / N)，S^2为计时的样本方差。
+		//
+		LongType n = threadStatistics._sampleCount;
+		LongType N = threadStatistics._entryCount;
+		double sum = (double)threadStatistics._costTime;
+		if (n == 0 || n >= N)
+		{
+			statistics._estimatedCostTime += threadStatistics._costTime;
+			continue;
+		}
+
+		statistics._estimatedCostTime += (LongType)(sum * N / n);
+		if (n > 1)
+		{
+			double square = sampleSquare;
+			double variance = (square - sum * sum / n) / (n - 1);
+			if (variance > 0)
+			{
+				estimateVariance += (double)N * N * variance / n * (1 - (double)n / N);
+			}
+		}
+	}
+
+	// 95%置信度的误差范围
+	statistics._errorBound = (LongType)(1.96 * sqrt(estimateVariance));
+
+	//
+	// 只合并最小到最大花费时间所在的桶，大多数剖析段只用到很少的桶，
+	// 剖析段很多时不用为每个剖析段分配和遍历完整的直方图。
+	// ps：读取快照之后新记录的值可能落在范围外，这部分不计入本次统计。
+	//
+	if (histogramCount)
+	{
+		int low = PerformanceHistogram::GetBucketIndex(statistics._minCostTime);
+		int high = PerformanceHistogram::GetBucketIndex(statistics._maxCostTime);
+		statistics._histogramBase = low;
+		statistics._histogram.assign(high - low + 1, 0);
+
+		for (size_t i = 0; i < histogramCount; ++i)
+		{
+			const PerformanceHistogram* histogram = i < MERGE_HISTOGRAM_COUNT
+				? histograms[i] : moreHistograms[i - MERGE_HISTOGRAM_COUNT];
+			for (int index = low; index <= high; ++index)
+			{
+				statistics._histogram[index - low] += histogram->GetCount(index);
+			}
+		}
+	}
+
+	statistics._p99 = statistics.GetPercentile(99);
+
+	// 复制资源统计信息，格式化时不再访问采样线程更新的数据
+	if (_rsStatistics)
+	{
+		statistics._resource.reset(new ResourceSnapshot);
+		_rsStatistics->GetSnapshot(*statistics._resource);
+	}
+}
+
+LongType PerformanceSectionStatistics::GetPercentile(double percent) const
+{
+	LongType total = 0;
+	for (size_t index = 0; index < _histogram.size(); ++index)
+	{
+		total += _histogram[index];
+	}
+
+	if (total == 0)
+		return 0;
+
+	// 第ceil(total * percent / 100)个值所在的桶
+	LongType rank = (LongType)ceil(total * percent / 100);
+	if (rank < 1)
+		rank = 1;
+
+	LongType count = 0;
+	for (size_t index = 0; index < _histogram.size(); ++index)
+	{
+		count += _histogram[index];
+		if (count >= rank)
+		{
+			// 桶代表的值是近似值，不超出实际的最小/最大值
+			LongType value = PerformanceHistogram::GetBucketValue(_histogramBase + (int)index);
+			if (value < _minCostTime)
+				value = _minCostTime;
+			if (value > _maxCostTime)
+				value = _maxCostTime;
+
+			return value;
+		}
+	}
+
+	return _maxCostTime;
+}
+
+void PerformanceProfilerSection::_BeginCounters(PerformanceThreadSlot* slot,
+	PerformanceThreadContext* context)
+{
+	PerformanceSectionCounters* counters = slot->_counters.load(memory_order_relaxed);
+	if (!ConfigManager::HasOption(PPCO_COUNTERS))
+	{
+		if (counters)
+			counters->_counting = false;
+
+		return;
+	}
+
+	if (counters == NULL)
+	{
+		PerformanceAllocTracker::Pause pause;
+		counters = new PerformanceSectionCounters;
+		slot->_counters.store(counters, memory_order_release);
+	}
+
+	context->GetCounterGroup()->Read(counters->_begin);
+	counters->_counting = true;
+}
+
+void PerformanceProfilerSection::_EndCounters(PerformanceThreadSlot* slot,
+	PerformanceThreadContext* context)
+{
+	PerformanceSectionCounters* counters = slot->_counters.load(memory_order_relaxed);
+	if (counters == NULL || !counters->_counting)
+		return;
+
+	LongType values[PPCT_COUNT];
+	context->GetCounterGroup()->Read(values);
+
+	for (int i = 0; i < PPCT_COUNT; ++i)
+	{
+		SlotAdd(counters->_values[i], values[i] - counters->_begin[i]);
+	}
+
+	SlotAdd(counters->_count, 1);
+	counters->_counting = false;
+}
+
+// 性能计数器在文本、JSON和CSV报告中的名字
+static const char* COUNTER_NAMES[PPCT_COUNT] = { "Cycles", "Instructions",
+	"Cache Misses", "Branch Misses", "Page Faults", "Context Switches", "Cpu Migrations" };
+static const char* COUNTER_JSON_NAMES[PPCT_COUNT] = { "cycles", "instructions",
+	"cacheMisses", "branchMisses", "pageFaults", "contextSwitches", "cpuMigrations" };
+
+//
+// CSV报告的列，线程明细行只填到off_cpu_time_ns，之后的
+// CSV_SECTION_COLUMNS列为剖析段汇总才有的统计。
+//
+static const char* CSV_REPORT_HEADER =
+	"id,description,file,function,line,row,thread_id,"
+	"cost_time_ns,call_count,entry_count,sample_count,cpu_time_ns,off_cpu_time_ns,"
+	"ref_count,estimated_cost_time_ns,error_bound_ns,"
+	"latency_min_ns,latency_mean_ns,latency_p50_ns,latency_p90_ns,latency_p99_ns,latency_p999_ns,latency_max_ns,"
+	"counter_count,cycles,instructions,cache_misses,branch_misses,page_faults,context_switches,cpu_migrations,"
+	"alloc_count,alloc_bytes,free_bytes,peak_live_bytes,"
+	"cpu_recent_peak,cpu_recent_p50,cpu_recent_p95,cpu_ewma_1s,cpu_ewma_10s,cpu_ewma_60s,cpu_peak,cpu_avg,"
+	"memory_recent_peak,memory_recent_p50,memory_recent_p95,memory_ewma_1s,memory_ewma_10s,memory_ewma_60s,memory_peak,memory_avg,"
+	"io_read_bytes,io_write_bytes,io_read_ops,io_write_ops,io_read_disk_bytes,io_write_disk_bytes,io_time_ms\n";
+static const int CSV_RESOURCE_COLUMNS = 8 + 8 + 7;
+static const int CSV_SECTION_COLUMNS = 3 + 7 + 1 + PPCT_COUNT + 4 + CSV_RESOURCE_COLUMNS;
+
+// JSON报告格式的版本，字段有不兼容的修改时递增
+static const int REPORT_FORMAT_VERSION = 1;
+
+// 花费时间中没有占用CPU的部分为阻塞时间(等待锁、IO、睡眠等)
+static LongType GetOffCpuTime(LongType cpuTime, LongType cpuWallTime)
+{
+	LongType wallTime = TimeEngine::TicksToNanoseconds(cpuWallTime);
+	return wallTime > cpuTime ? wallTime - cpuTime : 0;
+}
+
+// 序列化性能计数器，输出每次调用的平均值
+void PerformanceProfilerSection::_SerializeCounters(OutputBuffer& OB,
+	const PerformanceSectionStatistics& statistics)
+{
+
+	if (statistics._counterCount == 0)
+		return;
+
+	int mask = PerformanceCounterGroup::GetAvailableMask();
+	OB.Append("【Counters】 Count:").AppendInt(statistics._counterCount);
+
+	for (int i = 0; i < PPCT_COUNT; ++i)
+	{
+		if (mask & (1 << i))
+		{
+			OB.Append(", ").Append(COUNTER_NAMES[i]).Append("/Call:")
+				.AppendDouble((double)statistics._counters[i] / statistics._counterCount, 1);
+		}
+	}
+
+	// 每周期执行的指令数
+	if ((mask & (1 << PPCT_INSTRUCTIONS)) && statistics._counters[PPCT_CYCLES])
+	{
+		OB.Append(", IPC:").AppendDouble(
+			(double)statistics._counters[PPCT_INSTRUCTIONS] / statistics._counters[PPCT_CYCLES], 2);
+	}
+
+	OB.Append('\n');
+}
+
+// 序列化IO统计：总量、吞吐率和每次调用的IO量
+void PerformanceProfilerSection::_SerializeIO(OutputBuffer& OB, const ResourceSnapshot& snapshot,
+	const PerformanceSectionStatistics& statistics)
+{
+	const IOCounters& io = snapshot._ioCounters;
+	LongType ioTime = snapshot._ioTime;
+	if (ioTime <= 0 || io._readBytes < 0)
+		return;
+
+	OB.Append("【IO】 Read:").AppendInt(io._readBytes / 1024)
+		.Append("K(").AppendInt(io._readOps)
+		.Append(" ops), Write:").AppendInt(io._writeBytes / 1024)
+		.Append("K(").AppendInt(io._writeOps).Append(" ops)");
+
+	if (io._readDiskBytes >= 0)
+	{
+		OB.Append(", Disk Read:").AppendInt(io._readDiskBytes / 1024)
+			.Append("K, Disk Write:").AppendInt(io._writeDiskBytes / 1024).Append('K');
+	}
+
+	OB.Append(", Read Rate:").AppendInt(io._readBytes * 1000 / 1024 / ioTime)
+		.Append("K/s, Write Rate:").AppendInt(io._writeBytes * 1000 / 1024 / ioTime)
+		.Append("K/s, Ops Rate:").AppendInt((io._readOps + io._writeOps) * 1000 / ioTime)
+		.Append("/s");
+
+	if (statistics._totalEntryCount)
+	{
+		OB.Append(", Read/Call:").AppendInt(io._readBytes / statistics._totalEntryCount)
+			.Append("B, Write/Call:").AppendInt(io._writeBytes / statistics._totalEntryCount)
+			.Append('B');
+	}
+
+	OB.Append('\n');
+}
+
+// 序列化内存分配统计，没有分配和释放时不输出
+void PerformanceProfilerSection::_SerializeAlloc(OutputBuffer& OB,
+	const PerformanceSectionStatistics& statistics)
+{
+	if (statistics._totalAllocCount == 0 && statistics._totalFreeBytes == 0)
+		return;
+
+	OB.Append("【Alloc】 Count:").AppendInt(statistics._totalAllocCount)
+		.Append(", Alloc Bytes:").AppendInt(statistics._totalAllocBytes)
+		.Append(", Free Bytes:").AppendInt(statistics._totalFreeBytes)
+		.Append(", Peak Live Bytes:").AppendInt(statistics._peakLiveBytes)
+		.Append(", Alloc Bytes/Call:").AppendInt(statistics._totalCallCount
+			? statistics._totalAllocBytes / statistics._totalCallCount : 0)
+		.Append('\n');
+}
+
+// 序列化CPU时间和阻塞时间，没有统计CPU时间时不输出
+void PerformanceProfilerSection::_SerializeCpuTime(OutputBuffer& OB,
+	LongType cpuTime, LongType cpuWallTime)
+{
+	if (cpuWallTime == 0)
+		return;
+
+	OB.Append(", Cpu Time:").AppendInt(cpuTime)
+		.Append("ns, Off-Cpu Time:").AppendInt(GetOffCpuTime(cpuTime, cpuWallTime)).Append("ns");
+}
+
+void PerformanceProfilerSection::Serialize(OutputBuffer& OB,
+	const PerformanceSectionStatistics& statistics)
+{
+	// 若总的引用计数不等于0，则表示剖析段不匹配
+	if (statistics._totalRef)
+		OB.Append("Performance Profiler Not Match!\n");
+
+	// 序列化效率统计信息
+	for (size_t i = 0; i < statistics._threads.size(); ++i)
+	{
+		const PerformanceThreadStatistics& threadStatistics = statistics._threads[i];
+		OB.Append("Thread Id:").AppendInt(threadStatistics._threadId)
+			.Append(", Cost Time:").AppendInt(TimeEngine::TicksToNanoseconds(threadStatistics._costTime))
+			.Append("ns, Call Count:").AppendInt(threadStatistics._callCount);
+
+		_SerializeCpuTime(OB, threadStatistics._cpuTime, threadStatistics._cpuWallTime);
+		OB.Append('\n');
+	}
+
+	OB.Append("Total Cost Time:").AppendInt(TimeEngine::TicksToNanoseconds(statistics._totalCostTime))
+		.Append("ns, Total Call Count:").AppendInt(statistics._totalCallCount);
+
+	_SerializeCpuTime(OB, statistics._totalCpuTime, statistics._totalCpuWallTime);
+	OB.Append('\n');
+
+	// 采样计时时输出估算的总花费时间
+	if (statistics._totalSampleCount < statistics._totalEntryCount)
+	{
+		OB.Append("Sample Count:").AppendInt(statistics._totalSampleCount)
+			.Append('/').AppendInt(statistics._totalEntryCount)
+			.Append(", Estimated Cost Time:").AppendInt(TimeEngine::TicksToNanoseconds(statistics._estimatedCostTime))
+			.Append("ns, Error Bound:±").AppendInt(TimeEngine::TicksToNanoseconds(statistics._errorBound))
+			.Append("ns(95%)\n");
+	}
+
+	// 序列化延迟分布
+	if (statistics._totalSampleCount)
+	{
+		OB.Append("Latency Min:").AppendInt(TimeEngine::TicksToNanoseconds(statistics._minCostTime))
+			.Append("ns, Mean:").AppendInt(TimeEngine::TicksToNanoseconds(
+				statistics._totalCostTime / statistics._totalSampleCount))
+			.Append("ns, P50:").AppendInt(TimeEngine::TicksToNanoseconds(statistics.GetPercentile(50)))
+			.Append("ns, P90:").AppendInt(TimeEngine::TicksToNanoseconds(statistics.GetPercentile(90)))
+			.Append("ns, P99:").AppendInt(TimeEngine::TicksToNanoseconds(statistics._p99))
+			.Append("ns, P99.9:").AppendInt(TimeEngine::TicksToNanoseconds(statistics.GetPercentile(99.9)))
+			.Append("ns, Max:").AppendInt(TimeEngine::TicksToNanoseconds(statistics._maxCostTime))
+			.Append("ns\n");
+	}
+
+	_SerializeCounters(OB, statistics);
+	_SerializeAlloc(OB, statistics);
+
+	// 序列化资源统计信息
+	if (statistics._resource)
+	{
+		OB.Append("【Cpu】 ");
+		statistics._resource->_cpuInfo.Serialize(OB, "%", 1);
+
+		OB.Append("【Memory】 ");
+		statistics._resource->_memoryInfo.Serialize(OB, "K", 1024);
+
+		_SerializeIO(OB, *statistics._resource, statistics);
+	}
+}
+
+void PerformanceProfilerSection::SerializeJson(OutputBuffer& OB,
+	const PerformanceSectionStatistics& statistics)
+{
+	AppendJsonField(OB, "id", _id);
+	AppendJsonField(OB, "costTimeNs", TimeEngine::TicksToNanoseconds(statistics._totalCostTime));
+	AppendJsonField(OB, "callCount", statistics._totalCallCount);
+	AppendJsonField(OB, "entryCount", statistics._totalEntryCount);
+	AppendJsonField(OB, "sampleCount", statistics._totalSampleCount);
+	AppendJsonField(OB, "refCount", statistics._totalRef);
+	AppendJsonField(OB, "estimatedCostTimeNs",
+		TimeEngine::TicksToNanoseconds(statistics._estimatedCostTime));
+	AppendJsonField(OB, "errorBoundNs", TimeEngine::TicksToNanoseconds(statistics._errorBound));
+
+	if (statistics._totalCpuWallTime)
+	{
+		AppendJsonField(OB, "cpuTimeNs", statistics._totalCpuTime);
+		AppendJsonField(OB, "offCpuTimeNs",
+			GetOffCpuTime(statistics._totalCpuTime, statistics._totalCpuWallTime));
+	}
+
+	if (statistics._totalSampleCount)
+	{
+		OB.Append(",\"latencyNs\":{\"min\":")
+			.AppendInt(TimeEngine::TicksToNanoseconds(statistics._minCostTime));
+		AppendJsonField(OB, "mean", TimeEngine::TicksToNanoseconds(
+			statistics._totalCostTime / statistics._totalSampleCount));
+		AppendJsonField(OB, "p50", TimeEngine::TicksToNanoseconds(statistics.GetPercentile(50)));
+		AppendJsonField(OB, "p90", TimeEngine::TicksToNanoseconds(statistics.GetPercentile(90)));
+		AppendJsonField(OB, "p99", TimeEngine::TicksToNanoseconds(statistics._p99));
+		AppendJsonField(OB, "p999", TimeEngine::TicksToNanoseconds(statistics.GetPercentile(99.9)));
+		AppendJsonField(OB, "max", TimeEngine::TicksToNanoseconds(statistics._maxCostTime));
+		OB.Append('}');
+	}
+
+	// 性能计数器输出累计值，只输出当前环境可用的计数器
+	if (statistics._counterCount)
+	{
+		int mask = PerformanceCounterGroup::GetAvailableMask();
+		OB.Append(",\"counters\":{\"count\":").AppendInt(statistics._counterCount);
+		for (int i = 0; i < PPCT_COUNT; ++i)
+		{
+			if (mask & (1 << i))
+				AppendJsonField(OB, COUNTER_JSON_NAMES[i], statistics._counters[i]);
+		}
+		OB.Append('}');
+	}
+
+	if (statistics._totalAllocCount || statistics._totalFreeBytes)
+	{
+		OB.Append(",\"alloc\":{\"count\":").AppendInt(statistics._totalAllocCount);
+		AppendJsonField(OB, "allocBytes", statistics._totalAllocBytes);
+		AppendJsonField(OB, "freeBytes", statistics._totalFreeBytes);
+		AppendJsonField(OB, "peakLiveBytes", statistics._peakLiveBytes);
+		OB.Append('}');
+	}
+
+	// 资源统计输出原始值：CPU为百分比，内存为字节
+	if (statistics._resource)
+	{
+		const ResourceSnapshot& snapshot = *statistics._resource;
+		OB.Append(",\"cpu\":");
+		snapshot._cpuInfo.SerializeJson(OB);
+		OB.Append(",\"memory\":");
+		snapshot._memoryInfo.SerializeJson(OB);
+
+		// 没有成功采样过IO计数时不输出
+		const IOCounters& io = snapshot._ioCounters;
+		if (io._readBytes >= 0 && snapshot._ioTime > 0)
+		{
+			OB.Append(",\"io\":{\"readBytes\":").AppendInt(io._readBytes);
+			AppendJsonField(OB, "writeBytes", io._writeBytes);
+			AppendJsonField(OB, "readOps", io._readOps);
+			AppendJsonField(OB, "writeOps", io._writeOps);
+			if (io._readDiskBytes >= 0)
+			{
+				AppendJsonField(OB, "readDiskBytes", io._readDiskBytes);
+				AppendJsonField(OB, "writeDiskBytes", io._writeDiskBytes);
+			}
+			AppendJsonField(OB, "timeMs", snapshot._ioTime);
+			OB.Append('}');
+		}
+	}
+
+	OB.Append(",\"threads\":[");
+	for (size_t i = 0; i < statistics._threads.size(); ++i)
+	{
+		const PerformanceThreadStatistics& threadStatistics = statistics._threads[i];
+		OB.Append(i ? ",{\"threadId\":" : "{\"threadId\":").AppendInt(threadStatistics._threadId);
+		AppendJsonField(OB, "costTimeNs", TimeEngine::TicksToNanoseconds(threadStatistics._costTime));
+		AppendJsonField(OB, "callCount", threadStatistics._callCount);
+		AppendJsonField(OB, "entryCount", threadStatistics._entryCount);
+		AppendJsonField(OB, "sampleCount", threadStatistics._sampleCount);
+		if (threadStatistics._cpuWallTime)
+		{
+			AppendJsonField(OB, "cpuTimeNs", threadStatistics._cpuTime);
+			AppendJsonField(OB, "offCpuTimeNs",
+				GetOffCpuTime(threadStatistics._cpuTime, threadStatistics._cpuWallTime));
+		}
+		OB.Append('}');
+	}
+	OB.Append(']');
+
+	// 调用树中以该剖析段为子节点的边
+	if (!statistics._edges.empty())
+	{
+		OB.Append(",\"callers\":[");
+		for (size_t i = 0; i < statistics._edges.size(); ++i)
+		{
+			const PerformanceEdgeStatistics& edge = statistics._edges[i];
+			OB.Append(i ? ",{\"parentNode\":" : "{\"parentNode\":").AppendInt(edge._parentNode);
+			AppendJsonField(OB, "node", edge._node);
+			AppendJsonField(OB, "callCount", edge._callCount);
+			AppendJsonField(OB, "inclusiveTimeNs", TimeEngine::TicksToNanoseconds(edge._inclusiveTime));
+			AppendJsonField(OB, "exclusiveTimeNs", TimeEngine::TicksToNanoseconds(edge._exclusiveTime));
+			OB.Append('}');
+		}
+		OB.Append(']');
+	}
+}
+
+void PerformanceProfilerSection::SerializeCsv(OutputBuffer& OB, const PerformanceNode& node,
+	const PerformanceSectionStatistics& statistics)
+{
+	// 汇总行
+	OB.AppendInt(_id).Append(',');
+	node.SerializeCsv(OB);
+	OB.Append(",section,");
+
+	AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics._totalCostTime));
+	AppendCsvField(OB, statistics._totalCallCount);
+	AppendCsvField(OB, statistics._totalEntryCount);
+	AppendCsvField(OB, statistics._totalSampleCount);
+	if (statistics._totalCpuWallTime)
+	{
+		AppendCsvField(OB, statistics._totalCpuTime);
+		AppendCsvField(OB, GetOffCpuTime(statistics._totalCpuTime, statistics._totalCpuWallTime));
+	}
+	else
+	{
+		AppendCsvEmpty(OB, 2);
+	}
+
+	AppendCsvField(OB, statistics._totalRef);
+	AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics._estimatedCostTime));
+	AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics._errorBound));
+
+	if (statistics._totalSampleCount)
+	{
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics._minCostTime));
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(
+			statistics._totalCostTime / statistics._totalSampleCount));
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics.GetPercentile(50)));
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics.GetPercentile(90)));
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics._p99));
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics.GetPercentile(99.9)));
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(statistics._maxCostTime));
+	}
+	else
+	{
+		AppendCsvEmpty(OB, 7);
+	}
+
+	// 没有统计或者当前环境不可用的计数器为空
+	int mask = statistics._counterCount ? PerformanceCounterGroup::GetAvailableMask() : 0;
+	if (statistics._counterCount)
+		AppendCsvField(OB, statistics._counterCount);
+	else
+		AppendCsvEmpty(OB, 1);
+
+	for (int i = 0; i < PPCT_COUNT; ++i)
+	{
+		if (mask & (1 << i))
+			AppendCsvField(OB, statistics._counters[i]);
+		else
+			AppendCsvEmpty(OB, 1);
+	}
+
+	if (statistics._totalAllocCount || statistics._totalFreeBytes)
+	{
+		AppendCsvField(OB, statistics._totalAllocCount);
+		AppendCsvField(OB, statistics._totalAllocBytes);
+		AppendCsvField(OB, statistics._totalFreeBytes);
+		AppendCsvField(OB, statistics._peakLiveBytes);
+	}
+	else
+	{
+		AppendCsvEmpty(OB, 4);
+	}
+
+	if (statistics._resource)
+	{
+		const ResourceSnapshot& snapshot = *statistics._resource;
+		snapshot._cpuInfo.SerializeCsv(OB);
+		snapshot._memoryInfo.SerializeCsv(OB);
+
+		// 没有成功采样过IO计数时不输出
+		const IOCounters& io = snapshot._ioCounters;
+		if (io._readBytes >= 0 && snapshot._ioTime > 0)
+		{
+			AppendCsvField(OB, io._readBytes);
+			AppendCsvField(OB, io._writeBytes);
+			AppendCsvField(OB, io._readOps);
+			AppendCsvField(OB, io._writeOps);
+			if (io._readDiskBytes >= 0)
+			{
+				AppendCsvField(OB, io._readDiskBytes);
+				AppendCsvField(OB, io._writeDiskBytes);
+			}
+			else
+			{
+				AppendCsvEmpty(OB, 2);
+			}
+			AppendCsvField(OB, snapshot._ioTime);
+		}
+		else
+		{
+			AppendCsvEmpty(OB, 7);
+		}
+	}
+	else
+	{
+		AppendCsvEmpty(OB, CSV_RESOURCE_COLUMNS);
+	}
+
+	OB.Append('\n');
+
+	// 线程明细行，只有线程统计的列
+	for (size_t i = 0; i < statistics._threads.size(); ++i)
+	{
+		const PerformanceThreadStatistics& threadStatistics = statistics._threads[i];
+		OB.AppendInt(_id).Append(',');
+		node.SerializeCsv(OB);
+		OB.Append(",thread");
+
+		AppendCsvField(OB, threadStatistics._threadId);
+		AppendCsvField(OB, TimeEngine::TicksToNanoseconds(threadStatistics._costTime));
+		AppendCsvField(OB, threadStatistics._callCount);
+		AppendCsvField(OB, threadStatistics._entryCount);
+		AppendCsvField(OB, threadStatistics._sampleCount);
+		if (threadStatistics._cpuWallTime)
+		{
+			AppendCsvField(OB, threadStatistics._cpuTime);
+			AppendCsvField(OB, GetOffCpuTime(threadStatistics._cpuTime, threadStatistics._cpuWallTime));
+		}
+		else
+		{
+			AppendCsvEmpty(OB, 2);
+		}
+
+		AppendCsvEmpty(OB, CSV_SECTION_COLUMNS);
+		OB.Append('\n');
+	}
+}
+
+//////////////////////////////////////////////////////////////
+// PerformanceProfiler
+PerformanceProfilerSection* PerformanceProfiler::CreateSection(const char* fileName,
+	const char* function, int line, const char* extraDesc, bool isStatistics)
+{
+	PerformanceAllocTracker::Pause pause;
+	PerformanceProfilerSection* section = NULL;
+	PerformanceNode node(fileName, function, line, extraDesc);
+
+	unique_lock<mutex> Lock(_mutex);
+	auto it = _ppMap.find(node);
+	if (it != _ppMap.end())
+	{
+		section = it->second;
+	}
+	else
+	{
+		section = new PerformanceProfilerSection(_ppMap.size());
+		if (isStatistics)
+		{
+			section->_rsStatistics = new ResourceStatistics();
+		}
+
+		// 应用工具/接口预先设置的剖析段配置
+		SectionConfig config;
+		if (ConfigManager::GetInstance()->GetSectionConfig(node._desc,
+			GetFileLine(node), config))
+		{
+			section->ApplyConfig(config);
+		}
+
+		_ppMap[node] = section;
+	}
+
+	return section;
+}
+
+int PerformanceProfiler::ApplySectionConfig(const string& key, const SectionConfig& config)
+{
+	int count = 0;
+
+	unique_lock<mutex> Lock(_mutex);
+	auto it = _ppMap.begin();
+	for (; it != _ppMap.end(); ++it)
+	{
+		if (it->first._desc == key || GetFileLine(it->first) == key)
+		{
+			it->second->ApplyConfig(config);
+			++count;
+		}
+	}
+
+	return count;
+}
+
+void PerformanceProfiler::SerializeResourceState(SaveAdapter& SA)
+{
+	// 锁内只复制资源统计段，格式化在锁外进行
+	vector<pair<string, ResourceStatistics*> > sections;
+	{
+		unique_lock<mutex> Lock(_mutex);
+		auto it = _ppMap.begin();
+		for (; it != _ppMap.end(); ++it)
+		{
+			if (it->second->_rsStatistics)
+				sections.push_back(make_pair(it->first._desc, it->second->_rsStatistics));
+		}
+	}
+
+	ResourceSnapshot snapshot;
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		sections[i].second->GetSnapshot(snapshot);
+
+		SA.Save("Description:%s\n", sections[i].first.c_str());
+
+		SA.Save("【Cpu】 ");
+		snapshot._cpuInfo.Serialize(SA, "%", 1);
+
+		SA.Save("【Memory】 ");
+		snapshot._memoryInfo.Serialize(SA, "K", 1024);
+	}
+}
+
+PerformanceThreadContext* PerformanceProfiler::RegisterThreadContext()
+{
+	PerformanceAllocTracker::Pause pause;
+	PerformanceThreadContext* context = new PerformanceThreadContext(GetThreadId());
+
+	unique_lock<mutex> Lock(_threadMutex);
+	_threadContexts.push_back(context);
+	SetThreadExitCallback(context);
+
+	return context;
+}
+
+void PerformanceProfiler::UnregisterThreadContext(PerformanceThreadContext* context)
+{
+	PerformanceAllocTracker::Pause pause;
+	unique_lock<mutex> Lock(_threadMutex);
+	_retiredContexts.push_back(context);
+
+	if (_threadContextReaders == 0)
+		_MergeRetiredContexts();
+}
+
+int PerformanceProfiler::GetCallPathNode(int parentNode, int sectionId)
+{
+	PerformanceAllocTracker::Pause pause;
+	unique_lock<mutex> Lock(_callPathMutex);
+
+	LongType key = ((LongType)(parentNode + 1) << 32) | (unsigned int)sectionId;
+	unordered_map<LongType, int>::iterator it = _callPathMap.find(key);
+	if (it != _callPathMap.end())
+		return it->second;
+
+	// 递归进入路径上已有的剖析段时折叠到该祖先节点，调用路径不会随递归深度增长
+	int node = parentNode;
+	while (node >= 0 && _callPathNodes[node].second != sectionId)
+	{
+		node = _callPathNodes[node].first;
+	}
+
+	if (node < 0)
+	{
+		node = (int)_callPathNodes.size();
+		_callPathNodes.push_back(make_pair(parentNode, sectionId));
+	}
+
+	_callPathMap[key] = node;
+	return node;
+}
+
+void PerformanceProfiler::_AcquireThreadContexts(vector<PerformanceThreadContext*>& contexts)
+{
+	unique_lock<mutex> Lock(_threadMutex);
+	contexts = _threadContexts;
+	++_threadContextReaders;
+}
+
+void PerformanceProfiler::_ReleaseThreadContexts()
+{
+	PerformanceAllocTracker::Pause pause;
+	unique_lock<mutex> Lock(_threadMutex);
+	if (--_threadContextReaders == 0 && !_retiredContexts.empty())
+		_MergeRetiredContexts();
+}
+
+// 保留事件缓冲区的已退出线程数，每个缓冲区1.5M内存
+static const size_t MAX_RETIRED_TRACE_COUNT = 16;
+
+void PerformanceProfiler::_MergeRetiredContexts()
+{
+	if (_retiredContext == NULL)
+	{
+		_retiredContext = new PerformanceThreadContext(0);
+		_threadContexts.push_back(_retiredContext);
+	}
+
+	for (size_t i = 0; i < _retiredContexts.size(); ++i)
+	{
+		PerformanceThreadContext* context = _retiredContexts[i];
+		_retiredContext->Merge(*context);
+
+		// 事件不能合并，保留最近退出的若干个线程的事件缓冲区
+		PerformanceTraceBuffer* buffer = context->DetachTraceBuffer();
+		if (buffer)
+		{
+			if (_retiredTraces.size() >= MAX_RETIRED_TRACE_COUNT)
+			{
+				delete _retiredTraces.front().second;
+				_retiredTraces.erase(_retiredTraces.begin());
+			}
+
+			_retiredTraces.push_back(make_pair(context->GetThreadId(), buffer));
+		}
+
+		_threadContexts.erase(find(_threadContexts.begin(), _threadContexts.end(), context));
+		delete context;
+	}
+
+	_retiredContexts.clear();
+}
+
+//
+// Begin/End只访问当前线程的槽位，不加锁也不查找hash表，
+// 多个线程进入同一个剖析段时互不影响。
+//
+bool PerformanceProfilerSection::_IsSampling(PerformanceThreadSlot* slot,
+	PerformanceThreadContext* context)
+{
+	int mode = _sampleMode.load(memory_order_relaxed);
+	if (mode == PPSM_NONE)
+		return true;
+
+	LongType rate = _sampleRate.load(memory_order_relaxed);
+	if (mode == PPSM_EVERY_N)
+	{
+		// 每个线程的第一次进入计时，之后每N次计时一次
+		if (--slot->_sampleCountdown > 0)
+			return false;
+
+		slot->_sampleCountdown = rate;
+		return true;
+	}
+	else if (mode == PPSM_RANDOM)
+	{
+		return context->Random() % rate == 0;
+	}
+	else if (mode == PPSM_INTERVAL)
+	{
+		LongType now = TimeEngine::GetTicks();
+		if (now - slot->_lastSampleTime < rate)
+			return false;
+
+		slot->_lastSampleTime = now;
+		return true;
+	}
+
+	return true;
+}
+
+void PerformanceProfilerSection::_RecordCpuTime(PerformanceThreadSlot* slot,
+	LongType beginCpuTime, LongType costTime)
+{
+	if (beginCpuTime < 0)
+		return;
+
+	SlotAdd(slot->_cpuTime, TimeEngine::GetThreadCpuTime() - beginCpuTime);
+	SlotAdd(slot->_cpuWallTime, costTime);
+}
+
+void PerformanceProfilerSection::_RecordLatency(PerformanceThreadSlot* slot, LongType costTime)
+{
+	// 第一次计时时分配直方图，之后直接记录
+	PerformanceHistogram* histogram = slot->_histogram.load(memory_order_relaxed);
+	if (histogram == NULL)
+	{
+		PerformanceAllocTracker::Pause pause;
+		histogram = new PerformanceHistogram;
+		slot->_histogram.store(histogram, memory_order_release);
+
+		slot->_minCostTime.store(costTime, memory_order_relaxed);
+		slot->_maxCostTime.store(costTime, memory_order_relaxed);
+	}
+
+	histogram->Record(costTime);
+
+	if (costTime < slot->_minCostTime.load(memory_order_relaxed))
+		slot->_minCostTime.store(costTime, memory_order_relaxed);
+
+	if (costTime > slot->_maxCostTime.load(memory_order_relaxed))
+		slot->_maxCostTime.store(costTime, memory_order_relaxed);
+}
+
+void PerformanceProfilerSection::Begin()
+{
+	PerformanceThreadContext* context = PerformanceThreadContext::GetCurrent();
+	PerformanceThreadSlot* slot = context->GetSlot(_id);
+	if (slot == NULL)
+		return;
+
+	if (ConfigManager::HasOption(PPCO_TRACE))
+	{
+		context->Trace(_id, PerformanceTraceBuffer::EVENT_BEGIN);
+	}
+
+	// 更新调用次数统计
+	SlotAdd(slot->_callCount, 1);
+
+	// 引用计数 == 0 时更新段开始时间统计，解决剖析递归程序的问题。
+	LongType refCount = slot->_refCount.load(memory_order_relaxed);
+	if (refCount == 0)
+	{
+		SlotAdd(slot->_entryCount, 1);
+
+		// 采样时只对部分进入计时
+		slot->_sampling = _IsSampling(slot, context);
+		if (slot->_sampling)
+		{
+			_BeginCounters(slot, context);
+			slot->_beginCpuTime = ConfigManager::HasOption(PPCO_CPU_TIME)
+				? TimeEngine::GetThreadCpuTime() : -1;
+			slot->_beginTime.store(TimeEngine::GetTicks(), memory_order_relaxed);
+		}
+
+		// 开始资源统计
+		if (_rsStatistics)
+		{
+			_rsStatistics->StartStatistics();
+		}
+	}
+
+	// 更新剖析段开始结束的引用计数统计
+	slot->_refCount.store(refCount + 1, memory_order_relaxed);
+
+	// 只有统计调用树或内存分配时才需要剖析段栈
+	bool callTree = ConfigManager::HasOption(PPCO_CALL_TREE);
+	if (callTree || ConfigManager::HasOption(PPCO_ALLOC))
+	{
+		context->PushFrame(_id, slot, callTree);
+	}
+}
+
+void PerformanceProfilerSection::End()
+{
+	PerformanceThreadContext* context = PerformanceThreadContext::GetCurrent();
+	PerformanceThreadSlot* slot = context->GetSlot(_id);
+	if (slot == NULL)
+		return;
+
+	// 更新引用计数
+	LongType refCount = slot->_refCount.load(memory_order_relaxed) - 1;
+	slot->_refCount.store(refCount, memory_order_relaxed);
+
+	// 选项关闭前压入的帧仍需弹出
+	if (!context->IsFrameEmpty())
+	{
+		context->PopFrame(_id, refCount == 0);
+	}
+
+	//
+	// 引用计数 <= 0 时更新剖析段花费时间。
+	// 解决剖析递归程序的问题和剖析段不匹配的问题
+	//
+	if (refCount <= 0)
+	{
+		// 该线程进入过剖析段且本次进入计时才有开始时间
+		if (slot->_callCount.load(memory_order_relaxed) && slot->_sampling)
+		{
+			LongType costTime = TimeEngine::GetTicks() - slot->_beginTime.load(memory_order_relaxed);
+			SlotWriteBegin(slot);
+			if (refCount == 0)
+			{
+				SlotAdd(slot->_costTime, costTime);
+				SlotAdd(slot->_sampleCount, 1);
+				slot->_sampleSquare.store(slot->_sampleSquare.load(memory_order_relaxed)
+					+ (double)costTime * costTime, memory_order_relaxed);
+
+				_RecordLatency(slot, costTime);
+				_RecordCpuTime(slot, slot->_beginCpuTime, costTime);
+				_EndCounters(slot, context);
+			}
+			else
+			{
+				slot->_costTime.store(costTime, memory_order_relaxed);
+			}
+			SlotWriteEnd(slot);
+		}
+
+		// 停止资源统计
+		if (_rsStatistics)
+		{
+			_rsStatistics->StopStatistics();
+		}
+	}
+
+	if (ConfigManager::HasOption(PPCO_TRACE))
+	{
+		context->Trace(_id, PerformanceTraceBuffer::EVENT_END);
+	}
+}
+
+void PerformanceProfilerSection::BeginScope(PerformanceProfilerScope& scope)
+{
+	PerformanceThreadContext* context = PerformanceThreadContext::GetCurrent();
+	PerformanceThreadSlot* slot = context->GetSlot(_id);
+	if (slot == NULL)
+		return;
+
+	if (ConfigManager::HasOption(PPCO_TRACE))
+	{
+		context->Trace(_id, PerformanceTraceBuffer::EVENT_BEGIN);
+	}
+
+	SlotAdd(slot->_callCount, 1);
+
+	// 引用计数仍需维护，递归进入时只有最外层计时
+	LongType refCount = slot->_refCount.load(memory_order_relaxed);
+	scope._outermost = (refCount == 0);
+	if (scope._outermost)
+	{
+		SlotAdd(slot->_entryCount, 1);
+
+		scope._timed = _IsSampling(slot, context);
+		if (scope._timed)
+		{
+			_BeginCounters(slot, context);
+			scope._beginCpuTime = ConfigManager::HasOption(PPCO_CPU_TIME)
+				? TimeEngine::GetThreadCpuTime() : -1;
+			scope._beginTime = TimeEngine::GetTicks();
+		}
+
+		if (_rsStatistics)
+		{
+			_rsStatistics->StartStatistics();
+		}
+	}
+
+	slot->_refCount.store(refCount + 1, memory_order_relaxed);
+
+	// 只有统计调用树或内存分配时才需要剖析段栈
+	bool callTree = ConfigManager::HasOption(PPCO_CALL_TREE);
+	if (callTree || ConfigManager::HasOption(PPCO_ALLOC))
+	{
+		context->PushFrame(_id, slot, callTree);
+	}
+
+	scope._context = context;
+	scope._slot = slot;
+}
+
+void PerformanceProfilerSection::EndScope(PerformanceProfilerScope& scope)
+{
+	PerformanceThreadContext* context = scope._context;
+	PerformanceThreadSlot* slot = scope._slot;
+
+	slot->_refCount.store(slot->_refCount.load(memory_order_relaxed) - 1, memory_order_relaxed);
+
+	if (!context->IsFrameEmpty())
+	{
+		context->PopFrame(_id, scope._outermost);
+	}
+
+	if (scope._timed)
+	{
+		LongType costTime = TimeEngine::GetTicks() - scope._beginTime;
+		SlotWriteBegin(slot);
+		SlotAdd(slot->_costTime, costTime);
+		SlotAdd(slot->_sampleCount, 1);
+		slot->_sampleSquare.store(slot->_sampleSquare.load(memory_order_relaxed)
+			+ (double)costTime * costTime, memory_order_relaxed);
+
+		_RecordLatency(slot, costTime);
+		_RecordCpuTime(slot, scope._beginCpuTime, costTime);
+		_EndCounters(slot, context);
+		SlotWriteEnd(slot);
+	}
+
+	if (scope._outermost && _rsStatistics)
+	{
+		_rsStatistics->StopStatistics();
+	}
+
+	if (ConfigManager::HasOption(PPCO_TRACE))
+	{
+		context->Trace(_id, PerformanceTraceBuffer::EVENT_END);
+	}
+}
+
+PerformanceProfiler::PerformanceProfiler()
+{
+	// 程序结束时输出剖析结果
+	atexit(OutPut);
+
+	time(&_beginTime);
+
+	// 第一个剖析段创建之前初始化计时引擎
+	TimeEngine::Init(ConfigManager::GetInstance()->GetTimeSource());
+	_beginTicks = TimeEngine::GetTicks();
+	_intervalTicks = _beginTicks;
+	_retiredContext = NULL;
+	_threadContextReaders = 0;
+	_droppedFrameCount = 0;
+
+	IPCMonitorServer::GetInstance()->Start();
+}
+
+void PerformanceProfiler::OutPut()
+{
+	int flag = ConfigManager::GetInstance()->GetOptions();
+	if (flag & PPCO_SAVE_TO_CONSOLE)
+	{
+		ConsoleSaveAdapter CSA;
+		PerformanceProfiler::GetInstance()->_OutPut(CSA);
+	}
+
+	if (flag & PPCO_SAVE_TO_FILE)
+	{
+		FileSaveAdapter FSA("PerformanceProfilerReport.txt");
+		PerformanceProfiler::GetInstance()->_OutPut(FSA);
+	}
+
+	if (flag & PPCO_SAVE_TO_JSON)
+	{
+		FileSaveAdapter FSA("PerformanceProfilerReport.json");
+		PerformanceProfiler::GetInstance()->_OutPut(FSA, PPRF_JSON);
+	}
+
+	if (flag & PPCO_SAVE_TO_CSV)
+	{
+		FileSaveAdapter FSA("PerformanceProfilerReport.csv");
+		PerformanceProfiler::GetInstance()->_OutPut(FSA, PPRF_CSV);
+	}
+
+	if (flag & PPCO_SAVE_TO_SNAPSHOT)
+	{
+		FileSaveAdapter FSA("PerformanceProfilerReport.pps", "wb");
+		PerformanceProfiler::GetInstance()->_OutPut(FSA, PPRF_SNAPSHOT);
+	}
+
+	if (flag & PPCO_TRACE)
+	{
+		OutPutTrace();
+	}
+}
+
+void PerformanceProfiler::OutPutTrace()
+{
+	FileSaveAdapter FSA("PerformanceProfilerTrace.json");
+	PerformanceProfiler::GetInstance()->_OutPutTrace(FSA);
+}
+
+void PerformanceProfiler::_OutPutTrace(SaveAdapter& SA)
+{
+	vector<PerformanceThreadContext*> contexts;
+	_AcquireThreadContexts(contexts);
+
+	// 按剖析段id索引剖析段描述，剖析节点创建后不会删除
+	vector<string> names;
+	{
+		unique_lock<mutex> Lock(_mutex);
+		names.resize(_ppMap.size());
+		auto it = _ppMap.begin();
+		for (; it != _ppMap.end(); ++it)
+		{
+			names[it->second->_id] = JsonEscape(it->first._desc);
+		}
+	}
+
+	int processId = GetProcessId();
+
+	SA.Save("{\"traceEvents\":[\n");
+
+	// 已退出线程的事件缓冲区同样在Release之前不会释放
+	vector<pair<int, const PerformanceTraceBuffer*> > buffers;
+	{
+		unique_lock<mutex> Lock(_threadMutex);
+		buffers.assign(_retiredTraces.begin(), _retiredTraces.end());
+	}
+
+	for (size_t i = 0; i < contexts.size(); ++i)
+	{
+		const PerformanceTraceBuffer* buffer = contexts[i]->GetTraceBuffer();
+		if (buffer)
+			buffers.push_back(make_pair(contexts[i]->GetThreadId(), buffer));
+	}
+
+	bool first = true;
+	vector<PerformanceTraceEvent> events;
+	for (size_t i = 0; i < buffers.size(); ++i)
+	{
+		const PerformanceTraceBuffer* buffer = buffers[i].second;
+
+		events.clear();
+		buffer->Read(events);
+
+		for (size_t j = 0; j < events.size(); ++j)
+		{
+			const PerformanceTraceEvent& event = events[j];
+			if (event._sectionId >= (int)names.size())
+				continue;
+
+			// Chrome Trace的时间单位为微秒
+			double time = TimeEngine::TicksToNanoseconds(event._time - _beginTicks) / 1000.0;
+
+			SA.Save("%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+				first ? "" : ",\n",
+				names[event._sectionId].c_str(),
+				event._type == PerformanceTraceBuffer::EVENT_BEGIN ? 'B' : 'E',
+				time, processId, buffers[i].first);
+
+			first = false;
+		}
+	}
+
+	_ReleaseThreadContexts();
+
+	SA.Save("\n],\"displayTimeUnit\":\"ns\"}\n");
+}
+
+bool PerformanceProfiler::CompareByCallCount(const SectionReport* lhs,
+	const SectionReport* rhs)
+{
+	return lhs->_statistics._totalCallCount > rhs->_statistics._totalCallCount;
+}
+
+bool PerformanceProfiler::CompareByCostTime(const SectionReport* lhs,
+	const SectionReport* rhs)
+{
+	return lhs->_statistics._estimatedCostTime > rhs->_statistics._estimatedCostTime;
+}
+
+bool PerformanceProfiler::CompareByP99(const SectionReport* lhs,
+	const SectionReport* rhs)
+{
+	return lhs->_statistics._p99 > rhs->_statistics._p99;
+}
+
+//
+// 报告先格式化到复用的输出缓冲区中，最后一次写到保存适配器，
+// 不再每行调用一次Save和stdio。
+//
+void PerformanceProfiler::OutPutReport(SaveAdapter& SA, PP_REPORT_FORMAT format)
+{
+	_OutPut(SA, format);
+}
+
+void PerformanceProfiler::_OutPut(SaveAdapter& SA, PP_REPORT_FORMAT format)
+{
+	unique_lock<mutex> outputLock(_outputMutex);
+	OutputBuffer& OB = _outputBuffer;
+	OB.Clear();
+
+	vector<SectionReport*> vInfos;
+	_Statistics(vInfos);
+
+	if (format == PPRF_JSON)
+		_OutPutJson(OB, vInfos);
+	else if (format == PPRF_CSV)
+		_OutPutCsv(OB, vInfos);
+	else if (format == PPRF_SNAPSHOT)
+		_OutPutSnapshot(OB, vInfos);
+	else
+		_OutPutText(OB, vInfos);
+
+	OB.Flush(SA);
+}
+
+void PerformanceProfiler::_Statistics(vector<SectionReport*>& vInfos)
+{
+	vector<PerformanceThreadContext*> contexts;
+	_AcquireThreadContexts(contexts);
+
+	//
+	// 锁内只复制剖析段列表，剖析节点和剖析段创建后不会删除，unordered_map的
+	// 节点在rehash时也不会移动，所以锁外可以直接访问。合并统计信息读取的是
+	// 各线程槽位的顺序锁快照，格式化和输出都在锁外进行，不阻塞创建剖析段。
+	// 合并后的统计信息保存在复用的_reports中，再次输出时不用重新分配。
+	//
+	vector<SectionReport>& reports = _reports;
+	{
+		unique_lock<mutex> Lock(_mutex);
+		reports.resize(_ppMap.size());
+
+		auto it = _ppMap.begin();
+		for (int index = 0; it != _ppMap.end(); ++it, ++index)
+		{
+			reports[index]._node = &it->first;
+			reports[index]._section = it->second;
+		}
+	}
+
+	// 合并各线程槽位中的统计信息
+	vInfos.reserve(reports.size());
+	for (size_t index = 0; index < reports.size(); ++index)
+	{
+		reports[index]._statistics.Clear();
+		reports[index]._section->Statistics(contexts, reports[index]._statistics);
+		vInfos.push_back(&reports[index]);
+	}
+
+	_droppedFrameCount = 0;
+	for (size_t i = 0; i < contexts.size(); ++i)
+	{
+		_droppedFrameCount += contexts[i]->GetDroppedFrames();
+	}
+
+	_ReleaseThreadContexts();
+
+	// 按配置条件对剖析结果进行排序输出
+	int flag = ConfigManager::GetInstance()->GetOptions();
+	if (flag & PPCO_SAVE_BY_P99)
+		sort(vInfos.begin(), vInfos.end(), CompareByP99);
+	else if (flag & PPCO_SAVE_BY_COST_TIME)
+		sort(vInfos.begin(), vInfos.end(), CompareByCostTime);
+	else if (flag & PPCO_SAVE_BY_CALL_COUNT)
+		sort(vInfos.begin(), vInfos.end(), CompareByCallCount);
+}
+
+void PerformanceProfiler::_OutPutText(OutputBuffer& OB, const vector<SectionReport*>& vInfos)
+{
+	OB.Append("=============Performance Profiler Report==============\n\n");
+	OB.Append("Profiler Begin Time: ").Append(ctime(&_beginTime));
+	OB.Append("Time Source: ")
+		.Append(TimeEngine::GetSource() == PPTS_TSC ? "TSC" : "Monotonic").Append("\n\n");
+
+	for (int index = 0; index < vInfos.size(); ++index)
+	{
+		OB.Append("NO").AppendInt(index + 1)
+			.Append(". Description:").Append(vInfos[index]->_node->_desc).Append('\n');
+		vInfos[index]->_node->Serialize(OB);
+		vInfos[index]->_section->Serialize(OB, vInfos[index]->_statistics);
+		OB.Append('\n');
+	}
+
+	if (ConfigManager::HasOption(PPCO_CALL_TREE))
+	{
+		_OutPutCallTree(OB, _reports);
+	}
+
+	OB.Append("==========================end========================\n\n");
+}
+
+//
+// JSON报告：每个剖析段一个对象，时间都是整数纳秒，没有统计的项不输出。
+// 调用树的边以父剖析段id(-1为根)记录在子剖析段的callers中。
+//
+void PerformanceProfiler::_OutPutJson(OutputBuffer& OB, const vector<SectionReport*>& vInfos)
+{
+	OB.Append("{\"version\":").AppendInt(REPORT_FORMAT_VERSION)
+		.Append(",\"beginTime\":").AppendInt((LongType)_beginTime)
+		.Append(",\"pid\":").AppendInt(GetProcessId())
+		.Append(",\"timeSource\":\"")
+		.Append(TimeEngine::GetSource() == PPTS_TSC ? "TSC" : "Monotonic")
+		.Append("\",\n\"sections\":[");
+
+	for (size_t index = 0; index < vInfos.size(); ++index)
+	{
+		OB.Append(index ? ",\n{" : "\n{");
+		vInfos[index]->_node->SerializeJson(OB);
+		vInfos[index]->_section->SerializeJson(OB, vInfos[index]->_statistics);
+		OB.Append('}');
+	}
+
+	OB.Append("\n]}\n");
+}
+
+//
+// CSV报告：第一行为列名，每个剖析段先输出一行row为section的汇总，
+// 再为每个线程输出一行row为thread的明细，线程行只填线程统计的列。
+//
+void PerformanceProfiler::_OutPutCsv(OutputBuffer& OB, const vector<SectionReport*>& vInfos)
+{
+	OB.Append(CSV_REPORT_HEADER);
+
+	for (size_t index = 0; index < vInfos.size(); ++index)
+	{
+		vInfos[index]->_section->SerializeCsv(OB,
+			*vInfos[index]->_node, vInfos[index]->_statistics);
+	}
+}
+
+// 字符串加入快照的字符串表，相同的字符串只保存一份，返回偏移
+static unsigned int AddSnapshotString(string& table,
+	unordered_map<string, unsigned int>& offsets, const string& str)
+{
+	auto it = offsets.find(str);
+	if (it != offsets.end())
+		return it->second;
+
+	unsigned int offset = (unsigned int)table.size();
+	table.append(str.c_str(), str.size() + 1);
+	offsets[str] = offset;
+
+	return offset;
+}
+
+// 表的大小按8字节对齐，后面的表可以直接按记录访问
+static LongType AlignSnapshotSize(LongType size)
+{
+	return (size + 7) & ~7LL;
+}
+
+//
+// 二进制快照：先整理出剖析段、线程、直方图桶记录和字符串表，再按文件头、
+// 剖析段记录表、线程记录表、直方图桶记录表、字符串表的顺序写出。
+// 时间都换算为纳秒，直方图桶保存代表值，不依赖本机的计时源和分桶方式。
+//
+void PerformanceProfiler::_OutPutSnapshot(OutputBuffer& OB, const vector<SectionReport*>& vInfos)
+{
+	static_assert((int)PP_SNAPSHOT_COUNTER_COUNT == (int)PPCT_COUNT, "snapshot counter count mismatch");
+
+	vector<PerformanceSnapshotSection> sections(vInfos.size());
+	vector<PerformanceSnapshotThread> threads;
+	vector<PerformanceSnapshotBucket> buckets;
+
+	// 偏移0为空字符串
+	string strings(1, '\0');
+	unordered_map<string, unsigned int> stringOffsets;
+
+	for (size_t index = 0; index < vInfos.size(); ++index)
+	{
+		const PerformanceNode& node = *vInfos[index]->_node;
+		const PerformanceSectionStatistics& statistics = vInfos[index]->_statistics;
+		PerformanceSnapshotSection& section = sections[index];
+		memset(&section, 0, sizeof(section));
+
+		section._id = vInfos[index]->_section->_id;
+		section._line = node._line;
+		section._desc = AddSnapshotString(strings, stringOffsets, node._desc);
+		section._fileName = AddSnapshotString(strings, stringOffsets, node._fileName);
+		section._function = AddSnapshotString(strings, stringOffsets, node._function);
+
+		section._costTime = TimeEngine::TicksToNanoseconds(statistics._totalCostTime);
+		section._callCount = statistics._totalCallCount;
+		section._entryCount = statistics._totalEntryCount;
+		section._sampleCount = statistics._totalSampleCount;
+		section._refCount = statistics._totalRef;
+		section._estimatedCostTime = TimeEngine::TicksToNanoseconds(statistics._estimatedCostTime);
+		section._errorBound = TimeEngine::TicksToNanoseconds(statistics._errorBound);
+		section._minCostTime = TimeEngine::TicksToNanoseconds(statistics._minCostTime);
+		section._maxCostTime = TimeEngine::TicksToNanoseconds(statistics._maxCostTime);
+		section._cpuTime = statistics._totalCpuTime;
+		section._cpuWallTime = TimeEngine::TicksToNanoseconds(statistics._totalCpuWallTime);
+		section._counterCount = statistics._counterCount;
+		for (int i = 0; i < PPCT_COUNT; ++i)
+		{
+			section._counters[i] = statistics._counters[i];
+		}
+		section._allocCount = statistics._totalAllocCount;
+		section._allocBytes = statistics._totalAllocBytes;
+		section._freeBytes = statistics._totalFreeBytes;
+		section._peakLiveBytes = statistics._peakLiveBytes;
+
+		section._threadBegin = (unsigned int)threads.size();
+		section._threadCount = (unsigned int)statistics._threads.size();
+		for (size_t i = 0; i < statistics._threads.size(); ++i)
+		{
+			const PerformanceThreadStatistics& threadStatistics = statistics._threads[i];
+			PerformanceSnapshotThread thread;
+			memset(&thread, 0, sizeof(thread));
+
+			thread._threadId = threadStatistics._threadId;
+			thread._costTime = TimeEngine::TicksToNanoseconds(threadStatistics._costTime);
+			thread._callCount = threadStatistics._callCount;
+			thread._entryCount = threadStatistics._entryCount;
+			thread._sampleCount = threadStatistics._sampleCount;
+			thread._cpuTime = threadStatistics._cpuTime;
+			thread._cpuWallTime = TimeEngine::TicksToNanoseconds(threadStatistics._cpuWallTime);
+			threads.push_back(thread);
+		}
+
+		// 只保存计数不为0的桶，代表值不超出实际的最小/最大值
+		section._bucketBegin = (unsigned int)buckets.size();
+		for (size_t i = 0; i < statistics._histogram.size(); ++i)
+		{
+			if (statistics._histogram[i] == 0)
+				continue;
+
+			LongType value = PerformanceHistogram::GetBucketValue(statistics._histogramBase + (int)i);
+			value = max(statistics._minCostTime, min(value, statistics._maxCostTime));
+
+			PerformanceSnapshotBucket bucket;
+			bucket._value = TimeEngine::TicksToNanoseconds(value);
+			bucket._count = statistics._histogram[i];
+			buckets.push_back(bucket);
+		}
+		section._bucketCount = (unsigned int)buckets.size() - section._bucketBegin;
+	}
+
+	PerformanceSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header._magic, PP_SNAPSHOT_MAGIC, sizeof(header._magic));
+	header._version = PP_SNAPSHOT_VERSION;
+	header._headerSize = sizeof(PerformanceSnapshotHeader);
+	header._sectionSize = sizeof(PerformanceSnapshotSection);
+	header._threadSize = sizeof(PerformanceSnapshotThread);
+	header._bucketSize = sizeof(PerformanceSnapshotBucket);
+	header._sectionCount = (unsigned int)sections.size();
+	header._threadCount = (unsigned int)threads.size();
+	header._bucketCount = (unsigned int)buckets.size();
+	header._stringSize = (unsigned int)strings.size();
+	header._processId = GetProcessId();
+	header._timeSource = TimeEngine::GetSource();
+	header._counterMask = PerformanceCounterGroup::GetAvailableMask();
+	header._beginTime = _beginTime;
+	header._snapshotTime = time(NULL);
+	header._sectionOffset = AlignSnapshotSize(sizeof(header));
+	header._threadOffset = header._sectionOffset
+		+ AlignSnapshotSize((LongType)sections.size() * sizeof(PerformanceSnapshotSection));
+	header._bucketOffset = header._threadOffset
+		+ AlignSnapshotSize((LongType)threads.size() * sizeof(PerformanceSnapshotThread));
+	header._stringOffset = header._bucketOffset
+		+ AlignSnapshotSize((LongType)buckets.size() * sizeof(PerformanceSnapshotBucket));
+
+	// 各表的大小都是8的倍数，依次写出即在对应的偏移处
+	OB.Append((const char*)&header, sizeof(header));
+	if (!sections.empty())
+		OB.Append((const char*)&sections[0], sections.size() * sizeof(PerformanceSnapshotSection));
+	if (!threads.empty())
+		OB.Append((const char*)&threads[0], threads.size() * sizeof(PerformanceSnapshotThread));
+	if (!buckets.empty())
+		OB.Append((const char*)&buckets[0], buckets.size() * sizeof(PerformanceSnapshotBucket));
+	OB.Append(strings);
+}
+
+bool PerformanceProfiler::CompareIntervalByCostTime(const IntervalReport* lhs,
+	const IntervalReport* rhs)
+{
+	return lhs->_costTime > rhs->_costTime;
+}
+
+void PerformanceProfiler::_Delta(const SectionReport& report, IntervalBase& base,
+	IntervalReport& delta)
+{
+	const PerformanceSectionStatistics& statistics = report._statistics;
+	delta._report = &report;
+	delta._callCount = statistics._totalCallCount - base._callCount;
+	delta._sampleCount = statistics._totalSampleCount - base._sampleCount;
+	delta._costTime = statistics._estimatedCostTime - base._costTime;
+	delta._cpuTime = statistics._totalCpuTime - base._cpuTime;
+	delta._cpuWallTime = statistics._totalCpuWallTime - base._cpuWallTime;
+
+	//
+	// 累计的最小/最大花费时间只会扩大，上一周期直方图的桶范围包含在当前的范围内，
+	// 对应的桶相减即为周期内的直方图。
+	//
+	PerformanceSectionStatistics& intervalStatistics = delta._statistics;
+	intervalStatistics.Clear();
+	intervalStatistics._histogram = statistics._histogram;
+	intervalStatistics._histogramBase = statistics._histogramBase;
+	intervalStatistics._minCostTime = statistics._minCostTime;
+	intervalStatistics._maxCostTime = statistics._maxCostTime;
+
+	int offset = base._histogramBase - statistics._histogramBase;
+	if (offset >= 0 && offset + base._histogram.size() <= statistics._histogram.size())
+	{
+		for (size_t i = 0; i < base._histogram.size(); ++i)
+		{
+			intervalStatistics._histogram[offset + i] -= base._histogram[i];
+		}
+	}
+
+	// 当前累计值作为下一周期的基准
+	base._callCount = statistics._totalCallCount;
+	base._sampleCount = statistics._totalSampleCount;
+	base._costTime = statistics._estimatedCostTime;
+	base._cpuTime = statistics._totalCpuTime;
+	base._cpuWallTime = statistics._totalCpuWallTime;
+	base._histogramBase = statistics._histogramBase;
+	base._histogram = statistics._histogram;
+}
+
+//
+// 周期报告：只输出周期内有调用的剖析段，按周期内的花费时间降序排列。
+// 延迟分布由两次累计直方图相减得到，Max为周期内最大值所在桶的代表值。
+//
+void PerformanceProfiler::OutPutInterval(SaveAdapter& SA)
+{
+	unique_lock<mutex> outputLock(_outputMutex);
+	OutputBuffer& OB = _outputBuffer;
+	OB.Clear();
+
+	vector<SectionReport*> vInfos;
+	_Statistics(vInfos);
+
+	LongType ticks = TimeEngine::GetTicks();
+	LongType intervalTime = TimeEngine::TicksToNanoseconds(ticks - _intervalTicks);
+	_intervalTicks = ticks;
+
+	size_t count = 0;
+	for (size_t index = 0; index < vInfos.size(); ++index)
+	{
+		int id = vInfos[index]->_section->_id;
+		if (id >= (int)_intervalBases.size())
+			_intervalBases.resize(id + 1);
+		if (count == _intervalReports.size())
+			_intervalReports.resize(count + 1);
+
+		_Delta(*vInfos[index], _intervalBases[id], _intervalReports[count]);
+		if (_intervalReports[count]._callCount)
+			++count;
+	}
+
+	vector<const IntervalReport*> vIntervals(count);
+	for (size_t index = 0; index < count; ++index)
+	{
+		vIntervals[index] = &_intervalReports[index];
+	}
+
+	sort(vIntervals.begin(), vIntervals.end(), CompareIntervalByCostTime);
+
+	time_t now = time(NULL);
+	OB.Append("=============Performance Profiler Interval Report==============\n\n");
+	OB.Append("Report Time: ").Append(ctime(&now));
+	OB.Append("Interval: ").AppendInt(intervalTime / 1000000)
+		.Append("ms, Active Sections: ").AppendInt(count).Append("\n\n");
+
+	for (size_t index = 0; index < vIntervals.size(); ++index)
+	{
+		const IntervalReport& interval = *vIntervals[index];
+		OB.Append("NO").AppendInt(index + 1)
+			.Append(". Description:").Append(interval._report->_node->_desc).Append('\n');
+		interval._report->_node->Serialize(OB);
+
+		OB.Append("Cost Time:").AppendInt(TimeEngine::TicksToNanoseconds(interval._costTime))
+			.Append("ns, Call Count:").AppendInt(interval._callCount);
+		interval._report->_section->_SerializeCpuTime(OB, interval._cpuTime, interval._cpuWallTime);
+		OB.Append('\n');
+
+		if (interval._sampleCount)
+		{
+			const PerformanceSectionStatistics& statistics = interval._statistics;
+			OB.Append("Latency P50:").AppendInt(TimeEngine::TicksToNanoseconds(statistics.GetPercentile(50)))
+				.Append("ns, P90:").AppendInt(TimeEngine::TicksToNanoseconds(statistics.GetPercentile(90)))
+				.Append("ns, P99:").AppendInt(TimeEngine::TicksToNanoseconds(statistics.GetPercentile(99)))
+				.Append("ns, Max:").AppendInt(TimeEngine::TicksToNanoseconds(statistics.GetPercentile(100)))
+				.Append("ns\n");
+		}
+
+		OB.Append('\n');
+	}
+
+	OB.Append("==========================end========================\n\n");
+
+	OB.Flush(SA);
+}
+
+// 名字复制到共享内存记录中，超长时截断
+static void CopySharedMemoryName(char* dst, const string& src)
+{
+	size_t len = min(src.size(), (size_t)PP_SHARED_MEMORY_NAME_SIZE - 1);
+	memcpy(dst, src.c_str(), len);
+	dst[len] = '\0';
+}
+
+//
+// 发布到共享内存：记录按剖析段id索引，新剖析段的记录先写名字，
+// 所有记录写完后再增加记录数，读取方看到的记录都是完整的。
+// 每个记录的统计值用顺序锁包围，读取方重读直到一致。
+//
+void PerformanceProfiler::OutPutSharedMemory(PerformanceSharedMemoryHeader& header)
+{
+	unique_lock<mutex> outputLock(_outputMutex);
+
+	vector<SectionReport*> vInfos;
+	_Statistics(vInfos);
+
+	char* sections = (char*)&header + header._headerSize;
+	unsigned int count = header._sectionCount.load(memory_order_relaxed);
+	unsigned int newCount = count;
+	unsigned int droppedCount = 0;
+	for (size_t index = 0; index < vInfos.size(); ++index)
+	{
+		const PerformanceNode& node = *vInfos[index]->_node;
+		const PerformanceSectionStatistics& statistics = vInfos[index]->_statistics;
+		unsigned int id = vInfos[index]->_section->_id;
+		if (id >= header._capacity)
+		{
+			++droppedCount;
+			continue;
+		}
+
+		PerformanceSharedMemorySection& section = *(PerformanceSharedMemorySection*)(
+			sections + (size_t)id * header._sectionSize);
+		if (id >= count)
+		{
+			section._id = id;
+			section._line = node._line;
+			CopySharedMemoryName(section._desc, node._desc);
+			CopySharedMemoryName(section._fileName, node._fileName);
+			CopySharedMemoryName(section._function, node._function);
+			newCount = max(newCount, id + 1);
+		}
+
+		PerformanceSharedMemoryStatistics values;
+		values._callCount = statistics._totalCallCount;
+		values._entryCount = statistics._totalEntryCount;
+		values._sampleCount = statistics._totalSampleCount;
+		values._costTime = TimeEngine::TicksToNanoseconds(statistics._estimatedCostTime);
+		values._minCostTime = TimeEngine::TicksToNanoseconds(statistics._minCostTime);
+		values._maxCostTime = TimeEngine::TicksToNanoseconds(statistics._maxCostTime);
+		values._p50 = TimeEngine::TicksToNanoseconds(statistics.GetPercentile(50));
+		values._p90 = TimeEngine::TicksToNanoseconds(statistics.GetPercentile(90));
+		values._p99 = TimeEngine::TicksToNanoseconds(statistics._p99);
+		values._cpuTime = statistics._totalCpuTime;
+		values._cpuWallTime = TimeEngine::TicksToNanoseconds(statistics._totalCpuWallTime);
+		values._allocCount = statistics._totalAllocCount;
+		values._allocBytes = statistics._totalAllocBytes;
+
+		unsigned int sequence = section._sequence.load(memory_order_relaxed);
+		section._sequence.store(sequence + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		section._statistics.Store(values);
+		section._sequence.store(sequence + 2, memory_order_release);
+	}
+
+	header._droppedCount.store(droppedCount, memory_order_relaxed);
+	header._sectionCount.store(newCount, memory_order_release);
+	header._updateTime.store(chrono::duration_cast<chrono::milliseconds>(
+		chrono::system_clock::now().time_since_epoch()).count(), memory_order_relaxed);
+	header._updateCount.fetch_add(1, memory_order_release);
+}
+
+// 按包含时间降序输出子节点
+static bool CompareCallTreeChild(const pair<int, const PerformanceEdgeStatistics*>& lhs,
+	const pair<int, const PerformanceEdgeStatistics*>& rhs)
+{
+	return lhs.second->_inclusiveTime > rhs.second->_inclusiveTime;
+}
+
+void PerformanceProfiler::_OutPutCallTree(SaveAdapter& SA, const vector<SectionReport>& reports)
+{
+	// 按剖析段id索引剖析段
+	vector<const SectionReport*> idReports;
+	for (size_t index = 0; index < reports.size(); ++index)
+	{
+		int id = reports[index]._section->_id;
+		if (id >= (int)idReports.size())
+			idReports.resize(id + 1, NULL);
+
+		idReports[id] = &reports[index];
+	}
+
+	// 按父调用路径节点整理调用树的边
+	CallTreeChildren children(1);
+	for (size_t index = 0; index < reports.size(); ++index)
+	{
+		int id = reports[index]._section->_id;
+		const vector<PerformanceEdgeStatistics>& edges = reports[index]._statistics._edges;
+		for (size_t i = 0; i < edges.size(); ++i)
+		{
+			if (edges[i]._parentNode + 1 >= (int)children.size())
+				children.resize(edges[i]._parentNode + 2);
+
+			children[edges[i]._parentNode + 1].push_back(make_pair(id, &edges[i]));
+		}
+	}
+
+	for (size_t index = 0; index < children.size(); ++index)
+	{
+		sort(children[index].begin(), children[index].end(), CompareCallTreeChild);
+	}
+
+	SA.Save("=================Performance Call Tree=================\n\n");
+
+	if (_droppedFrameCount)
+	{
+		SA.Save("Dropped Frames:%lld (unmatched begin/end or stack deeper than %d)\n\n",
+			_droppedFrameCount, (int)PerformanceThreadContext::MAX_FRAME_DEPTH);
+	}
+
+	vector<int> path;
+	_OutPutCallTreeNode(SA, idReports, children, -1, path);
+
+	SA.Save("\n");
+}
+
+void PerformanceProfiler::_OutPutCallTreeNode(SaveAdapter& SA,
+	const vector<const SectionReport*>& idReports, const CallTreeChildren& children,
+	int parentNode, vector<int>& path)
+{
+	if (parentNode + 1 >= (int)children.size())
+		return;
+
+	const vector<pair<int, const PerformanceEdgeStatistics*> >& nodes = children[parentNode + 1];
+	for (size_t index = 0; index < nodes.size(); ++index)
+	{
+		int id = nodes[index].first;
+		const PerformanceEdgeStatistics* edge = nodes[index].second;
+
+		// 递归调用折叠到路径上的祖先节点，不再展开
+		bool recursive = find(path.begin(), path.end(), edge->_node) != path.end();
+
+		SA.Save("%*s%s [Call Count:%lld, Inclusive Time:%lldns, Exclusive Time:%lldns]%s\n",
+			(int)path.size() * 4, "",
+			idReports[id]->_node->_desc.c_str(),
+			edge->_callCount,
+			TimeEngine::TicksToNanoseconds(edge->_inclusiveTime),
+			TimeEngine::TicksToNanoseconds(edge->_exclusiveTime),
+			recursive ? " (Recursive)" : "");
+
+		if (!recursive)
+		{
+			path.push_back(edge->_node);
+			_OutPutCallTreeNode(SA, idReports, children, edge->_node, path);
+			path.pop_back();
+		}
+	}
+}
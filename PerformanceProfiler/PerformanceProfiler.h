@@ -2,11 +2,19 @@
 
 #include <iostream>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <malloc.h>
 #include <string>
 #include <map>
+#include <vector>
 #include <algorithm>
+#include <new>
 
 // C++11
 #include <unordered_map>
@@ -14,23 +22,40 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <memory>
 
 #ifdef _WIN32
 #include <Windows.h>
 #include<Psapi.h>
+#include <intrin.h>
 #pragma comment(lib,"Psapi.lib")
 #else
 #include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 #endif // _WIN32
 
+// 支持rdtsc指令的平台
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PP_HAS_RDTSC
+#endif
+
 using namespace std;
 
 #include "../IPC/IPCManager.h"
+#include "PerformanceSnapshot.h"
+#include "PerformanceSharedMemory.h"
 
 typedef long long LongType;
 
 
-// ̬⵼̬⣬Ϊ̬
+// 解决动态库导出静态变量的问题，单例类对象为静态对象
 #if(defined(_WIN32) && defined(IMPORT))
 #define API_EXPORT _declspec(dllimport)
 #elif _WIN32
@@ -40,7 +65,20 @@ typedef long long LongType;
 #endif
 
 //
-// ȡǰ߳id
+// 线程局部存储 / 缓存行对齐
+//
+#ifdef _WIN32
+#define PP_THREAD_LOCAL __declspec(thread)
+#define PP_CACHE_ALIGN __declspec(align(64))
+#else
+// 接管malloc时在malloc内访问线程局部变量，编译为动态库时默认的TLS模型经__tls_get_addr
+// 访问，可能再次分配内存而递归，所以使用initial-exec模型
+#define PP_THREAD_LOCAL __thread __attribute__((tls_model("initial-exec")))
+#define PP_CACHE_ALIGN __attribute__((aligned(64)))
+#endif
+
+//
+// 获取当前线程id
 //
 static int GetThreadId()
 {
@@ -51,14 +89,20 @@ static int GetThreadId()
 #endif
 }
 
-// 
+// 保存适配器抽象基类
 class SaveAdapter
 {
 public:
 	virtual int Save(char* format, ...) = 0;
+
+	// 写出一整块已格式化好的数据，默认转交给Save
+	virtual int Write(const char* data, size_t len)
+	{
+		return Save("%.*s", (int)len, data);
+	}
 };
 
-// ̨
+// 控制台保存适配器
 class ConsoleSaveAdapter : public SaveAdapter
 {
 public:
@@ -73,16 +117,73 @@ public:
 
 		return cnt;
 	}
+
+	virtual int Write(const char* data, size_t len)
+	{
+		return (int)fwrite(data, 1, len, stdout);
+	}
+};
+
+// 字符串保存适配器
+class StringSaveAdapter : public SaveAdapter
+{
+public:
+	StringSaveAdapter(string& str)
+		:_str(str)
+	{}
+
+	virtual int Save(char* format, ...)
+	{
+		char buf[1024];
+		va_list argPtr;
+		int cnt;
+
+		va_start(argPtr, format);
+		cnt = vsnprintf(buf, sizeof(buf), format, argPtr);
+		va_end(argPtr);
+
+		if (cnt < 0)
+			return 0;
+
+		// 超过缓冲区长度时按实际长度重新格式化
+		if (cnt >= (int)sizeof(buf))
+		{
+			vector<char> bigBuf(cnt + 1);
+			va_start(argPtr, format);
+			vsnprintf(&bigBuf[0], bigBuf.size(), format, argPtr);
+			va_end(argPtr);
+
+			_str.append(&bigBuf[0], cnt);
+			return cnt;
+		}
+
+		_str.append(buf, cnt);
+		return cnt;
+	}
+
+	virtual int Write(const char* data, size_t len)
+	{
+		_str.append(data, len);
+		return (int)len;
+	}
+private:
+	string& _str;
 };
 
-// ļ
+// 文件保存适配器
 class FileSaveAdapter : public SaveAdapter
 {
 public:
-	FileSaveAdapter(const char* path)
+	FileSaveAdapter(const char* path, const char* mode = "w")
 		:_fOut(0)
 	{
-		_fOut = fopen(path, "w");
+		_fOut = fopen(path, mode);
+
+		// 逐行Save时使用较大的全缓冲，减少write系统调用
+		if (_fOut)
+		{
+			setvbuf(_fOut, NULL, _IOFBF, FILE_BUFFER_SIZE);
+		}
 	}
 
 	~FileSaveAdapter()
@@ -109,7 +210,46 @@ public:
 
 		return 0;
 	}
+
+	//
+	// 整块数据不经过stdio缓冲，先刷出之前Save的内容，再直接写文件描述符。
+	// ps：write可能只写出一部分，需要循环写完。
+	//
+	virtual int Write(const char* data, size_t len)
+	{
+		if (_fOut == NULL)
+			return 0;
+
+		fflush(_fOut);
+
+#ifdef _WIN32
+		return (int)fwrite(data, 1, len, _fOut);
+#else
+		int fd = fileno(_fOut);
+		size_t written = 0;
+		while (written < len)
+		{
+			ssize_t cnt = ::write(fd, data + written, len - written);
+			if (cnt < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				break;
+			}
+
+			written += cnt;
+		}
+
+		return (int)written;
+#endif
+	}
 private:
+	enum
+	{
+		FILE_BUFFER_SIZE = 64 * 1024,	// stdio缓冲区大小
+	};
+
 	FileSaveAdapter(const FileSaveAdapter&);
 	FileSaveAdapter& operator==(const FileSaveAdapter&);
 
@@ -117,7 +257,94 @@ private:
 	FILE* _fOut;
 };
 
-// 
+//
+// 输出缓冲区
+// 报告先格式化到一块可复用的大缓冲区中，最后由保存适配器一次写出。
+// 整数和浮点数使用手写的格式化，不经过printf的格式解析；其他格式仍可以
+// 通过Save格式化到缓冲区，所以输出缓冲区本身也是一个保存适配器。
+// ps：缓冲区只增长不收缩，第一次输出报告之后不再分配内存。
+//
+class OutputBuffer : public SaveAdapter
+{
+public:
+	OutputBuffer()
+		:_size(0)
+	{}
+
+	virtual int Save(char* format, ...);
+	virtual int Write(const char* data, size_t len);
+
+	OutputBuffer& Append(const char* str, size_t len)
+	{
+		memcpy(_Reserve(len), str, len);
+		_size += len;
+		return *this;
+	}
+
+	OutputBuffer& Append(const char* str)
+	{
+		return Append(str, strlen(str));
+	}
+
+	OutputBuffer& Append(const string& str)
+	{
+		return Append(str.c_str(), str.size());
+	}
+
+	OutputBuffer& Append(char ch)
+	{
+		*_Reserve(1) = ch;
+		++_size;
+		return *this;
+	}
+
+	// 追加十进制整数
+	OutputBuffer& AppendInt(LongType value);
+
+	// 追加定点小数，precision为小数位数(0~9)
+	OutputBuffer& AppendDouble(double value, int precision);
+
+	const char* Data() const
+	{
+		return _size ? &_buffer[0] : "";
+	}
+
+	size_t Size() const
+	{
+		return _size;
+	}
+
+	void Clear()
+	{
+		_size = 0;
+	}
+
+	// 将缓冲区中的内容一次写到保存适配器
+	int Flush(SaveAdapter& SA)
+	{
+		int cnt = SA.Write(Data(), _size);
+		_size = 0;
+		return cnt;
+	}
+private:
+	// 保证缓冲区尾部至少有len字节可写，返回写入位置
+	char* _Reserve(size_t len)
+	{
+		if (_size + len > _buffer.size())
+		{
+			_Grow(len);
+		}
+
+		return &_buffer[0] + _size;
+	}
+
+	void _Grow(size_t len);
+
+	vector<char> _buffer;	// 缓冲区
+	size_t _size;			// 已写入的长度
+};
+
+// 单例基类
 //template<class T>
 //class Singleton
 //{
@@ -133,11 +360,11 @@ private:
 //	static T* _sInstance;
 //};
 //
-//// ָ̬ʼ֤̰߳ȫ 
+//// 静态对象指针初始化，保证线程安全。 
 //template<class T>
 //T* Singleton<T>::_sInstance = new T();
 
-// 
+// 单例基类
 //template<class T>
 //class Singleton
 //{
@@ -153,18 +380,18 @@ private:
 //	static T* _sInstance;
 //};
 //
-//// ָ̬ʼ֤̰߳ȫ 
+//// 静态对象指针初始化，保证线程安全。 
 //template<class T>
 //T* Singleton<T>::_sInstance = new T();
 
 //
-// Ǿ̬ڴĵ캯лIPCϢ̡߳
-// ɶ̬ʱmain֮ǰͻȼض̬⣬ʹķʽʱ
-// ͻᴴʱIPCϢ߳̾ͻῨʹĵģʽ
-// ڵһȡʱ
+// 单例对象是静态对象，在内存管理的单例对象构造函数中会启动IPC的消息服务线程。
+// 当编译成动态库时，程序main入口之前就会先加载动态库，而使用上面的方式，这时
+// 就会创建单例对象，这时创建IPC的消息服务线程就会卡死。所以使用下面的单例模式，
+// 在第一获取单例对象时，创建单例对象。
 //
 
-// 
+// 单例基类
 template<class T>
 class Singleton
 {
@@ -172,7 +399,7 @@ public:
 	static T* GetInstance()
 	{
 		//
-		// 1.˫ؼ鱣̰߳ȫЧʡ
+		// 1.双重检查保障线程安全和效率。
 		//
 		if (_sInstance == NULL)
 		{
@@ -189,8 +416,8 @@ protected:
 	Singleton()
 	{}
 
-	static T* _sInstance;	// ʵ
-	static mutex _mutex;	// 
+	static T* _sInstance;	// 单实例对象
+	static mutex _mutex;	// 互斥锁对象
 };
 
 template<class T>
@@ -201,177 +428,550 @@ mutex Singleton<T>::_mutex;
 
 enum PP_CONFIG_OPTION
 {
-	PPCO_NONE = 0,					// 
-	PPCO_PROFILER = 2,				// 
-	PPCO_SAVE_TO_CONSOLE = 4,		// 浽̨
-	PPCO_SAVE_TO_FILE = 8,			// 浽ļ
-	PPCO_SAVE_BY_CALL_COUNT = 16,	// ô򱣴
-	PPCO_SAVE_BY_COST_TIME = 32,	// ûʱ併򱣴
+	PPCO_NONE = 0,					// 不做剖析
+	PPCO_PROFILER = 2,				// 开启剖析
+	PPCO_SAVE_TO_CONSOLE = 4,		// 保存到控制台
+	PPCO_SAVE_TO_FILE = 8,			// 保存到文件
+	PPCO_SAVE_BY_CALL_COUNT = 16,	// 按调用次数降序保存
+	PPCO_SAVE_BY_COST_TIME = 32,	// 按调用花费时间降序保存
+	PPCO_SAVE_BY_P99 = 64,			// 按p99延迟降序保存
+	PPCO_CALL_TREE = 128,			// 统计剖析段的调用树(包含/自身时间)
+	PPCO_TRACE = 256,				// 记录剖析段开始/结束事件，输出Chrome Trace格式的时间线
+	PPCO_CPU_TIME = 512,			// 统计剖析段占用的线程CPU时间和阻塞(Off-Cpu)时间
+	PPCO_COUNTERS = 1024,			// 统计剖析段的性能计数器(CPU周期、指令、缺页等)
+	PPCO_ALLOC = 2048,				// 统计剖析段的堆内存分配(需定义PERFORMANCE_PROFILER_TRACK_ALLOC编译)
+	PPCO_SAVE_TO_JSON = 4096,		// 保存JSON格式的报告到文件
+	PPCO_SAVE_TO_CSV = 8192,		// 保存CSV格式的报告到文件
+	PPCO_SAVE_TO_SNAPSHOT = 16384,	// 保存二进制快照到文件
+};
+
+// 剖析报告格式
+enum PP_REPORT_FORMAT
+{
+	PPRF_TEXT = 0,		// 文本，便于阅读
+	PPRF_JSON = 1,		// JSON，时间为整数纳秒，便于程序解析
+	PPRF_CSV = 2,		// CSV，每个剖析段一行汇总，每个线程一行明细
+	PPRF_SNAPSHOT = 3,	// 二进制快照，格式见PerformanceSnapshot.h
+};
+
+// 计时源
+enum PP_TIME_SOURCE
+{
+	PPTS_AUTO = 0,			// 支持不变TSC时使用TSC，否则使用单调时钟
+	PPTS_TSC = 1,			// rdtsc读取CPU时间戳计数器
+	PPTS_MONOTONIC = 2,		// 单调时钟(Linux下clock_gettime，Windows下QueryPerformanceCounter)
+};
+
+//
+// 剖析段采样方式
+// 调用非常频繁的剖析段每次都计时开销太大，采样方式下只对部分调用计时，
+// 调用次数仍然精确统计，报告中按采样结果估算总花费时间并给出误差范围。
+//
+enum PP_SAMPLE_MODE
+{
+	PPSM_NONE = 0,			// 不采样，每次调用都计时
+	PPSM_EVERY_N = 1,		// 每个线程每N次调用计时一次
+	PPSM_RANDOM = 2,		// 每个线程每次调用以1/N的概率计时
+	PPSM_INTERVAL = 3,		// 每个线程每个时间间隔(微秒)计时一次
 };
 
 //
-// ù
+// 剖析段配置，按剖析段描述或"文件名:行号"设置
+//
+struct SectionConfig
+{
+	bool _enable;			// 是否开启剖析段
+	int _sampleMode;		// 采样方式(PP_SAMPLE_MODE)
+	LongType _sampleRate;	// 采样率N，或者采样时间间隔(微秒)
+
+	SectionConfig()
+		:_enable(true)
+		, _sampleMode(PPSM_NONE)
+		, _sampleRate(1)
+	{}
+};
+
+//
+// 配置管理
 //
 class API_EXPORT ConfigManager : public Singleton<ConfigManager>
 {
+	typedef map<string, SectionConfig> SectionConfigMap;
 public:
 	void SetOptions(int flag)
 	{
-		_flag = flag;
+		_sOptions._flag.store(flag, memory_order_relaxed);
 	}
 	int GetOptions()
 	{
-		return _flag;
+		return _sOptions._flag.load(memory_order_relaxed);
+	}
+
+	//
+	// 剖析是否开启，剖析段宏每次执行都会检查。
+	// 直接读静态的原子变量，不经过单例指针检查。
+	//
+	static bool IsProfilerEnable()
+	{
+		return (_sOptions._flag.load(memory_order_relaxed) & PPCO_PROFILER) != 0;
+	}
+
+	// 是否设置了剖析选项，剖析段内部使用
+	static bool HasOption(int option)
+	{
+		return (_sOptions._flag.load(memory_order_relaxed) & option) != 0;
+	}
+
+	// 计时源需在第一个剖析段创建之前设置
+	void SetTimeSource(int source)
+	{
+		_timeSource = source;
+	}
+	int GetTimeSource()
+	{
+		return _timeSource;
 	}
 
+	//
+	// 按剖析段描述或"文件名:行号"开启/关闭剖析段，对已创建和之后创建的剖析段都有效。
+	// 返回已创建的剖析段中匹配的个数。
+	//
+	int SetSectionEnable(const string& key, bool enable);
+
+	// 按剖析段描述或"文件名:行号"设置剖析段的采样方式，返回已创建的剖析段中匹配的个数。
+	int SetSectionSampling(const string& key, int mode, LongType rate);
+
+	// 获取剖析段的配置，"文件名:行号"的配置优先于描述的配置
+	bool GetSectionConfig(const string& desc, const string& fileLine,
+		SectionConfig& config);
+
 	ConfigManager()
-		:_flag(PPCO_NONE)
+		:_timeSource(PPTS_AUTO)
 	{}
 private:
-	int _flag;
+	//
+	// 剖析选项，工具控制线程写，所有剖析线程读，独占一个缓存行，
+	// 避免和其他频繁写的数据伪共享。
+	//
+	struct PP_CACHE_ALIGN Options
+	{
+		atomic<int> _flag;
+
+		Options()
+			:_flag(PPCO_NONE)
+		{}
+	};
+
+	static Options _sOptions;
+
+	int _timeSource;
+
+	mutex _configMutex;					// 剖析段配置锁
+	SectionConfigMap _sectionConfigMap;	// 剖析段配置
+};
+
+//
+// 计时引擎
+// 剖析段使用墙上时间计时，clock()统计的是进程CPU时间且精度很低，sleep的剖析段
+// 计时为0，多线程时又会重复计算。TSC不变(频率恒定且各核同步)时直接读取rdtsc，
+// 启动时和单调时钟对比校准一次计数到纳秒的换算，否则退化为单调时钟。
+//
+class API_EXPORT TimeEngine
+{
+public:
+	// 选择计时源并校准，由剖析器初始化时调用一次
+	static void Init(int source);
+
+	// 获取当前时钟计数
+	static LongType GetTicks()
+	{
+#ifdef PP_HAS_RDTSC
+		if (_source == PPTS_TSC)
+			return (LongType)__rdtsc();
+#endif
+		return _GetMonotonicTicks();
+	}
+
+	// 时钟计数转换为纳秒
+	static LongType TicksToNanoseconds(LongType ticks)
+	{
+		return (LongType)(ticks * _nanosecondsPerTick);
+	}
+
+	// 纳秒转换为时钟计数
+	static LongType NanosecondsToTicks(LongType nanoseconds)
+	{
+		return (LongType)(nanoseconds / _nanosecondsPerTick);
+	}
+
+	// 获取当前线程占用的CPU时间(纳秒)
+	static LongType GetThreadCpuTime();
+
+	// 获取实际使用的计时源
+	static int GetSource()
+	{
+		return _source;
+	}
+private:
+	static LongType _GetMonotonicTicks();
+	static bool _IsInvariantTsc();
+
+	static int _source;					// 实际使用的计时源
+	static double _nanosecondsPerTick;	// 每个时钟计数的纳秒数
 };
 
 ///////////////////////////////////////////////////////////////////////////
-// Դͳ
+// 资源统计
 
-// ԴͳϢ
+//
+// 资源统计信息
+// 保存最近的带时间戳的样本(环形缓冲区)，以及1秒、10秒、60秒的指数加权移动平均，
+// 长时间运行时报告的是最近的峰值和百分位，而不是整个生命期的平均值。
+//
 struct ResourceInfo
 {
-	LongType _peak;	 // ֵ
-	LongType _avg;	 // ƽֵ
+	enum
+	{
+		SAMPLE_COUNT = 1024,		// 保存的样本数，按100毫秒的采样间隔超过60秒
+		RECENT_WINDOW = 60000,		// 报告最近样本的时间窗口(毫秒)
+	};
 
-	LongType _total;  // ֵ
-	LongType _count;  // 
+	LongType _peak;	 // 整个生命期的最大峰值
+	LongType _avg;	 // 整个生命期的平均值
+
+	LongType _total;  // 总值
+	LongType _count;  // 次数
+
+	double _ewma1s;			// 1秒指数加权移动平均
+	double _ewma10s;		// 10秒指数加权移动平均
+	double _ewma60s;		// 60秒指数加权移动平均
+	LongType _lastTime;		// 最近一个样本的时间(毫秒)
+
+	LongType _times[SAMPLE_COUNT];		// 样本时间
+	LongType _values[SAMPLE_COUNT];		// 样本值
 
 	ResourceInfo()
 		: _peak(0)
 		,_avg(0)
 		, _total(0)
 		,_count(0)
+		, _ewma1s(0)
+		, _ewma10s(0)
+		, _ewma60s(0)
+		, _lastTime(0)
+	{}
+
+	// 更新一个时间为time(毫秒)的样本
+	void Update(LongType value, LongType time);
+
+	// 最近window毫秒内样本的峰值和百分位，没有样本时返回false
+	bool GetRecent(LongType window, LongType& peak, LongType& p50, LongType& p95) const;
+
+	// 序列化，数值除以scale后加上单位unit输出
+	void Serialize(SaveAdapter& SA, const char* unit, LongType scale) const;
+
+	// 序列化为JSON对象/CSV的列，输出原始数值
+	void SerializeJson(OutputBuffer& OB) const;
+	void SerializeCsv(OutputBuffer& OB) const;
+};
+
+// IO计数，不支持的项为-1
+struct IOCounters
+{
+	LongType _readBytes;		// 读的字节数(包括缓存命中)
+	LongType _writeBytes;		// 写的字节数
+	LongType _readOps;			// 读操作次数
+	LongType _writeOps;			// 写操作次数
+	LongType _readDiskBytes;	// 实际从存储设备读的字节数(仅Linux)
+	LongType _writeDiskBytes;	// 实际写到存储设备的字节数(仅Linux)
+
+	IOCounters()
+		:_readBytes(0)
+		, _writeBytes(0)
+		, _readOps(0)
+		, _writeOps(0)
+		, _readDiskBytes(0)
+		, _writeDiskBytes(0)
 	{}
 
-	void Update(LongType value);
-	void Serialize(SaveAdapter& SA) const;
+	// 累加两次IO计数的差值
+	void AddDelta(const IOCounters& end, const IOCounters& begin);
+};
+
+// 进程资源的一次采样
+struct ResourceSample
+{
+	LongType _systemTime;	// 系统时间(毫秒)
+	LongType _kernelTime;	// 进程占用的CPU时间(毫秒)
+	LongType _memory;		// 内存使用(字节)
+	IOCounters _io;			// IO计数
+	int _cpuCount;			// CPU个数
+};
+
+// 资源统计信息的快照
+struct ResourceSnapshot
+{
+	ResourceInfo _cpuInfo;			// CPU信息
+	ResourceInfo _memoryInfo;		// 内存信息
+	IOCounters _ioCounters;			// 统计期间累计的IO计数
+	LongType _ioTime;				// 累计IO计数的统计时间(毫秒)
 };
 
-// Դͳ
+// 资源统计
 class ResourceStatistics
 {
+	friend class ResourceSampler;
 public:
 	ResourceStatistics();
-	~ResourceStatistics();
 
-	// ʼͳ
+	// 开始统计
 	void StartStatistics();
 
-	// ֹͣͳ
+	// 停止统计
 	void StopStatistics();
 
-	// ȡCPU/ڴϢ 
-	const ResourceInfo& GetCpuInfo();
-	const ResourceInfo& GetMemoryInfo();
+	// 获取CPU/内存/IO信息的快照，和采样线程的更新互斥
+	void GetSnapshot(ResourceSnapshot& snapshot);
 
 private:
-	void _Statistics();
+	// 采样线程用本次进程资源采样更新统计信息
+	void _UpdateStatistics(const ResourceSample& sample);
 
-// WindowsLinuxʵԴͳ
-#ifdef _WIN32
-	// ȡCPU / ȡںʱ
+	// 计算CPU占用率
+	LongType _GetCpuUsageRate(const ResourceSample& sample);
+
+	// 重置最近的时间，下次采样时重新开始计算CPU占用率
+	void _Reset();
+
+public:
+	LongType _lastSystemTime;	// 最近的系统时间
+	LongType _lastKernelTime;	// 最近的内核时间
+
+	ResourceInfo _cpuInfo;				// CPU信息
+	ResourceInfo _memoryInfo;			// 内存信息
+
+	IOCounters _ioCounters;				// 统计期间累计的IO计数
+	LongType _ioTime;					// 累计IO计数的统计时间
+	IOCounters _lastIOCounters;			// 最近一次采样的IO计数
+	LongType _lastIOTime;				// 最近一次采样IO的系统时间，-1表示没有
+
+	atomic<int> _refCount;				// 引用计数
+};
+
+//
+// 资源采样服务
+// 所有资源统计段共用一个采样线程，每个时间片对进程资源采样一次，
+// 分发给当前正在统计的资源统计段。没有正在统计的段时阻塞等待。
+//
+class ResourceSampler : public Singleton<ResourceSampler>
+{
+	friend class Singleton<ResourceSampler>;
+	friend class ResourceStatistics;
+public:
+	// 注册资源统计段
+	void Register(ResourceStatistics* statistics);
+
+	// 资源统计段开始/停止统计
+	void Activate();
+	void Deactivate();
+
+protected:
+	ResourceSampler();
+
+	// 采样线程处理函数
+	void _Run();
+
+	// 对进程资源采样
+	void _Sample(ResourceSample& sample);
+
+// Windows和Linux下实现资源采样
+	// 获取CPU个数 / 获取内核时间(毫秒) / 获取系统时间(毫秒)
 	int _GetCpuCount();
 	LongType _GetKernelTime();
+	LongType _GetSystemTime();
 
-	// ȡCPU/ڴ/IOϢ
-	LongType _GetCpuUsageRate();
+	// 获取内存/IO信息
 	LongType _GetMemoryUsage();
-	void _GetIOUsage(LongType& readBytes, LongType& writeBytes);
+	void _GetIOUsage(IOCounters& io);
 
-	// ͳϢ
-	void _UpdateStatistics();
-#else // Linux
-	void _UpdateStatistics();
+#ifndef _WIN32
+	// 读取/proc下的文件到buf，返回读取的长度
+	int _ReadProcFile(int fd, char* buf, int size);
 #endif
 
-public:
-#ifdef _WIN32
-	int	_cpuCount;				// CPU
-	HANDLE _processHandle;		// ̾
+private:
+	int	_cpuCount;				// CPU个数
 
-	LongType _lastSystemTime;	// ϵͳʱ
-	LongType _lastKernelTime;	// ںʱ
+#ifdef _WIN32
+	HANDLE _processHandle;		// 进程句柄
 #else
-	int _pid;					// ID
+	int _statFd;				// /proc/self/stat，CPU时间
+	int _statmFd;				// /proc/self/statm，内存页数
+	int _ioFd;					// /proc/self/io，IO计数
+	LongType _selfReadBytes;	// 采样自身读取/proc的字节数，从IO计数中扣除
+	LongType _selfReadOps;		// 采样自身读取/proc的次数
+	LongType _clockTicks;		// 每秒的时钟滴答数
+	LongType _pageSize;			// 内存页大小
 #endif // _WIN32
 
-	ResourceInfo _cpuInfo;				// CPUϢ
-	ResourceInfo _memoryInfo;			// ڴϢ
-	//ResourceInfo _readIOInfo;			// Ϣ
-	//ResourceInfo _writeIOInfo;		// дݵϢ
-
-	atomic<int> _refCount;				// ü
-	mutex _lockMutex;					// ̻߳
-	condition_variable _condVariable;	// ǷͳƵ
-	thread _statisticsThread;			// ͳ߳
+	vector<ResourceStatistics*> _statisticsList;	// 注册的资源统计段
+	int _activeCount;								// 正在统计的资源统计段个数
+	mutex _lockMutex;								// 线程互斥锁
+	condition_variable _condVariable;				// 控制是否进行采样的条件变量
+	thread _samplerThread;							// 采样线程
 };
 
 //////////////////////////////////////////////////////////////////////
-// IPC߿Ƽ
+// IPC在线控制监听服务
 
 class IPCMonitorServer : public Singleton<IPCMonitorServer>
 {
 	friend class Singleton<IPCMonitorServer>;
-	typedef void(*CmdFunc) (string& reply);
+	typedef void(*CmdFunc) (const string& args, string& reply);
 	typedef map<string, CmdFunc> CmdFuncMap;
 
 public:
-	// IPCϢ߳
+	// 启动IPC消息处理服务线程
 	void Start();
 
 protected:
-	// IPC̴߳Ϣĺ
+	// IPC服务线程处理消息的函数
 	void OnMessage();
 
 	//
-	// ¾Ϊ۲ģʽУӦϢĵĴ
+	// 以下均为观察者模式中，对应命令消息的的处理函数
 	//
-	static void GetState(string& reply);
-	static void Enable(string& reply);
-	static void Disable(string& reply);
-	static void Save(string& reply);
+	static void GetState(const string& args, string& reply);
+	static void Enable(const string& args, string& reply);
+	static void Disable(const string& args, string& reply);
+	static void Save(const string& args, string& reply);
+	static void EnableSection(const string& args, string& reply);
+	static void DisableSection(const string& args, string& reply);
+	static void SetSectionSampling(const string& args, string& reply);
+	static void Trace(const string& args, string& reply);
+	static void SetReportInterval(const string& args, string& reply);
+	static void SetSharedMemory(const string& args, string& reply);
+	static void Report(const string& args, string& reply);
 
 	IPCMonitorServer();
 private:
-	thread	_onMsgThread;			// Ϣ߳
-	CmdFuncMap _cmdFuncsMap;		// Ϣִкӳ
+	thread	_onMsgThread;			// 处理消息线程
+	CmdFuncMap _cmdFuncsMap;		// 消息命令到执行函数的映射表
+};
+
+//////////////////////////////////////////////////////////////////////
+// 周期报告
+
+//
+// 周期报告服务
+// 长期运行不退出的程序只有在退出或工具保存时才有剖析报告，周期报告服务在
+// 独立的线程中每隔一段时间输出一次各剖析段在这个周期内的增量统计(调用次数、
+// 花费时间、延迟分布)，追加到PerformanceProfilerInterval.txt中。
+// 文件超过大小上限后轮转为.1、.2...，只保留指定个数的旧文件。
+// ps：第一次设置时间间隔时才启动报告线程，不使用时没有额外开销。
+//
+class PerformanceReporter : public Singleton<PerformanceReporter>
+{
+	friend class Singleton<PerformanceReporter>;
+public:
+	// 设置报告的时间间隔(秒)，0表示停止周期报告
+	void SetInterval(int seconds);
+	int GetInterval();
+
+	// 设置报告文件的大小上限(字节)和轮转保留的旧文件个数
+	void SetRotation(LongType maxFileSize, int maxFileCount);
+
+protected:
+	PerformanceReporter();
+
+	// 报告线程处理函数
+	void _Run();
+
+	// 输出一次周期报告，文件超过大小上限时轮转
+	void _Report(LongType maxFileSize, int maxFileCount);
+	void _Rotate(int maxFileCount);
+
+private:
+	int _interval;						// 报告的时间间隔(秒)
+	bool _changed;						// 时间间隔是否修改过，修改后重新计时
+	LongType _maxFileSize;				// 报告文件的大小上限
+	int _maxFileCount;					// 轮转保留的旧文件个数
+	mutex _lockMutex;					// 线程互斥锁
+	condition_variable _condVariable;	// 等待下一周期或时间间隔修改的条件变量
+	thread _reporterThread;				// 报告线程，第一次设置时间间隔时启动
+};
+
+//////////////////////////////////////////////////////////////////////
+// 共享内存发布
+
+//
+// 共享内存发布服务
+// 在独立的线程中周期性地把各剖析段合并后的统计值发布到命名的共享内存区，
+// 工具只读映射共享内存即可高频查看实时统计，不需要通过IPC让被剖析进程生成报告。
+// 共享内存区的格式见PerformanceSharedMemory.h，进程退出时删除。
+//
+class PerformancePublisher : public Singleton<PerformancePublisher>
+{
+	friend class Singleton<PerformancePublisher>;
+public:
+	// 设置发布的时间间隔(毫秒)，0表示停止发布，创建共享内存区失败时返回false
+	bool SetInterval(int milliseconds);
+	int GetInterval();
+
+protected:
+	PerformancePublisher();
+
+	// 发布线程处理函数
+	void _Run();
+
+	// 创建/删除共享内存区
+	bool _Create();
+	static void _Destroy();
+
+private:
+	int _interval;							// 发布的时间间隔(毫秒)
+	PerformanceSharedMemoryHeader* _header;	// 映射的共享内存区
+	size_t _size;							// 共享内存区大小
+#ifdef _WIN32
+	HANDLE _hMapping;						// 文件映射句柄
+#endif
+	mutex _lockMutex;						// 线程互斥锁
+	condition_variable _condVariable;		// 等待下一周期或时间间隔修改的条件变量
+	thread _publisherThread;				// 发布线程，第一次设置时间间隔时启动
 };
 
 ///////////////////////////////////////////////////////////////////////////
-// 
+// 代码段剖析
 
 //
-// ڵ
+// 性能剖析节点
 //
 struct API_EXPORT PerformanceNode
 {
-	string _fileName;	// ļ
-	string _function;	// 
-	int	   _line;		// к
-	string _desc;		// 
+	string _fileName;	// 文件名
+	string _function;	// 函数名
+	int	   _line;		// 行号
+	string _desc;		// 附加描述
 
 	PerformanceNode(const char* fileName, const char* function,
 		int line, const char* desc);
 
 	//
-	// mapֵҪoperator<
-	// unorder_mapֵҪoperator==
+	// 做map键值，所以需要重载operator<
+	// 做unorder_map键值，所以需要重载operator==
 	//
 	bool operator<(const PerformanceNode& p) const;
 	bool operator==(const PerformanceNode& p) const;
 
-	// лڵϢ
-	void Serialize(SaveAdapter& SA) const;
+	// 序列化节点信息到容器
+	void Serialize(OutputBuffer& OB) const;
+
+	// 序列化为JSON对象的成员/CSV的列
+	void SerializeJson(OutputBuffer& OB) const;
+	void SerializeCsv(OutputBuffer& OB) const;
 };
 
-// hash㷨
+// hash算法
 static size_t BKDRHash(const char *str)
 {
 	unsigned int seed = 131; // 31 131 1313 13131 131313
@@ -385,11 +985,11 @@ static size_t BKDRHash(const char *str)
 	return (hash & 0x7FFFFFFF);
 }
 
-// ʵPerformanceNodeHashºunorder_mapıȽ
+// 实现PerformanceNodeHash仿函数做unorder_map的比较器
 class PerformanceNodeHash
 {
 public:
-	size_t operator() (const PerformanceNode& p)
+	size_t operator() (const PerformanceNode& p) const
 	{
 		string key = p._function;
 		key += p._fileName;
@@ -400,39 +1000,673 @@ public:
 };
 
 //
-// 
+// 延迟直方图
+// 对数线性分桶(类似HDR Histogram)：小于16的值每个值一个桶，之后每个2的幂区间
+// 再线性分成16个桶，相对误差不超过1/32，内存大小固定。
+// 直方图只由所属线程写，生成报告时合并各线程的直方图。
 //
-class API_EXPORT PerformanceProfilerSection
+class PerformanceHistogram
 {
-	//typedef unordered_map<thread::id, LongType> StatisMap;
-	typedef unordered_map<int, LongType> StatisMap;
-
-	friend class PerformanceProfiler;
 public:
-	PerformanceProfilerSection()
-		:_totalRef(0)
-		, _rsStatistics(0)
-		, _totalCallCount(0)
-		, _totalCostTime(0)
-	{}
-
-	void Begin(int threadId);
-	void End(int threadId);
+	enum
+	{
+		SUB_BUCKET_BITS = 4,										// 每个2的幂区间线性分桶的位数
+		SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS,					// 每个2的幂区间的桶数
+		MAX_BIT = 47,												// 可记录的最大值的最高位
+		BUCKET_COUNT = (MAX_BIT - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT,	// 总桶数
+	};
 
-	void Serialize(SaveAdapter& SA);
+	PerformanceHistogram()
+	{
+		for (int i = 0; i < BUCKET_COUNT; ++i)
+		{
+			_buckets[i].store(0, memory_order_relaxed);
+		}
+	}
+
+	// 所属线程记录一个值
+	void Record(LongType value)
+	{
+		atomic<LongType>& bucket = _buckets[GetBucketIndex(value)];
+		bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	}
+
+	LongType GetCount(int index) const
+	{
+		return _buckets[index].load(memory_order_relaxed);
+	}
+
+	// 合并已退出线程的直方图时累加桶计数
+	void Add(int index, LongType count)
+	{
+		_buckets[index].store(_buckets[index].load(memory_order_relaxed) + count, memory_order_relaxed);
+	}
+
+	// 值所在的桶
+	static int GetBucketIndex(LongType value);
+
+	// 桶代表的值(桶区间的中间值)
+	static LongType GetBucketValue(int index);
+private:
+	atomic<LongType> _buckets[BUCKET_COUNT];
+};
+
+//
+// 调用树的边(父调用路径->子剖析段)，保存在子剖析段的槽位中
+// 调用路径节点由剖析器统一分配，同一条调用路径在所有线程上的节点id相同，
+// 按父节点区分边，从多个父剖析段进入的剖析段的子树分别统计，不会重复计算。
+// 边只由所属线程创建和更新，创建后插入链表头部发布，不会删除。
+//
+struct PerformanceEdge
+{
+	int _parentNode;				// 父调用路径节点id，-1表示没有父剖析段
+	int _node;						// 经过这条边到达的调用路径节点id
+	atomic<LongType> _callCount;	// 调用次数
+	atomic<LongType> _inclusiveTime;// 包含子剖析段的花费时间(递归时只统计最外层)
+	atomic<LongType> _exclusiveTime;// 自身花费时间(不包含子剖析段)
+	PerformanceEdge* _next;			// 同一个子剖析段的下一条边
+
+	PerformanceEdge(int parentNode, int node, PerformanceEdge* next)
+		:_parentNode(parentNode)
+		, _node(node)
+		, _callCount(0)
+		, _inclusiveTime(0)
+		, _exclusiveTime(0)
+		, _next(next)
+	{}
+};
+
+// 性能计数器
+enum PP_COUNTER
+{
+	PPCT_CYCLES = 0,			// CPU周期数
+	PPCT_INSTRUCTIONS,			// 指令数
+	PPCT_CACHE_MISSES,			// 缓存未命中次数
+	PPCT_BRANCH_MISSES,			// 分支预测失败次数
+	PPCT_PAGE_FAULTS,			// 缺页次数
+	PPCT_CONTEXT_SWITCHES,		// 上下文切换次数
+	PPCT_CPU_MIGRATIONS,		// CPU迁移次数
+	PPCT_COUNT,
+};
+
+//
+// 线程性能计数器组
+// Linux下用perf_event_open为所属线程打开软件计数器组(缺页、上下文切换、CPU迁移)，
+// 内核允许时再打开硬件计数器组(周期、指令、缓存未命中、分支预测失败)，每组一次read
+// 读取所有计数器。perf事件不可用时退化为getrusage(RUSAGE_THREAD)的缺页和上下文切换次数。
+// Windows下只有QueryThreadCycleTime的CPU周期数。
+//
+class PerformanceCounterGroup
+{
+public:
+	PerformanceCounterGroup();
+	~PerformanceCounterGroup();
+
+	// 所属线程读取计数器的当前值，不可用的计数器为0
+	void Read(LongType values[PPCT_COUNT]);
+
+	// 可用计数器的掩码(1 << PP_COUNTER)，合并所有线程
+	static int GetAvailableMask()
+	{
+		return _sAvailableMask.load(memory_order_relaxed);
+	}
+private:
+#ifndef _WIN32
+	enum
+	{
+		GROUP_SOFTWARE = 0,		// 软件计数器组
+		GROUP_HARDWARE = 1,		// 硬件计数器组
+		GROUP_COUNT = 2,
+	};
+
+	// 打开一组perf事件，第一个打开成功的为组长
+	void _OpenGroup(int group, int type, const int* counters, const int* configs, int count);
+
+	int _groupFds[GROUP_COUNT];					// 组长fd，-1表示不可用
+	vector<int> _memberFds;						// 所有打开的fd
+	int _groupCounters[GROUP_COUNT][PPCT_COUNT];	// 组内按读取顺序的计数器
+	int _groupSizes[GROUP_COUNT];				// 组内计数器个数
+	bool _rusage;								// 是否退化为getrusage
+#endif
+
+	static atomic<int> _sAvailableMask;			// 可用计数器的掩码
+};
+
+// 剖析段在一个线程上累计的性能计数器，第一次统计时分配
+struct PerformanceSectionCounters
+{
+	atomic<LongType> _values[PPCT_COUNT];	// 累计的计数
+	atomic<LongType> _count;				// 统计了计数器的进入次数
+	LongType _begin[PPCT_COUNT];			// 开始时的计数器值，只由所属线程访问
+	bool _counting;							// 本次进入是否统计，只由所属线程访问
+
+	PerformanceSectionCounters()
+		:_count(0)
+		, _counting(false)
+	{
+		for (int i = 0; i < PPCT_COUNT; ++i)
+		{
+			_values[i].store(0, memory_order_relaxed);
+			_begin[i] = 0;
+		}
+	}
+};
+
+//
+// 剖析段在一个线程上的统计槽位
+// 槽位只由所属线程写，生成报告时由其他线程读，所以使用relaxed的原子变量，
+// 所属线程写时只是普通的读写指令，不需要加锁和lock前缀的原子操作。
+// 槽位按缓存行对齐，避免不同线程的槽位伪共享。
+//
+struct PP_CACHE_ALIGN PerformanceThreadSlot
+{
+	atomic<unsigned int> _sequence;	// 顺序锁，奇数表示所属线程正在更新统计值
+	atomic<LongType> _beginTime;	// 开始时间
+	atomic<LongType> _costTime;		// 花费时间
+	atomic<LongType> _refCount;		// 引用计数(解决剖析段首尾不匹配，递归函数内部段剖析)
+	atomic<LongType> _callCount;	// 调用次数
+
+	atomic<LongType> _entryCount;	// 最外层进入次数(引用计数为0时的调用)
+	atomic<LongType> _sampleCount;	// 计时的次数
+	atomic<double> _sampleSquare;	// 计时花费时间的平方和，用于估算误差
+	atomic<LongType> _minCostTime;	// 单次最小花费时间
+	atomic<LongType> _maxCostTime;	// 单次最大花费时间
+	atomic<PerformanceHistogram*> _histogram;	// 延迟直方图，第一次计时时分配
+	atomic<LongType> _cpuTime;		// 线程CPU时间(纳秒)
+	atomic<LongType> _cpuWallTime;	// 统计了CPU时间的那部分花费时间
+	atomic<PerformanceSectionCounters*> _counters;	// 性能计数器，第一次统计时分配
+	atomic<LongType> _allocCount;	// 内存分配次数
+	atomic<LongType> _allocBytes;	// 分配的字节数
+	atomic<LongType> _freeBytes;	// 释放的字节数
+	atomic<LongType> _peakLiveBytes;	// 未释放字节数的峰值
+	LongType _liveBytes;			// 未释放的字节数，只由所属线程访问
+	atomic<PerformanceEdge*> _edges;	// 调用树中以该剖析段为子节点的边
+	PerformanceEdge* _lastEdge;		// 上次使用的边，只由所属线程访问
+	LongType _sampleCountdown;		// 每N次采样的倒计数，只由所属线程访问
+	LongType _lastSampleTime;		// 按时间间隔采样的上次采样时间，只由所属线程访问
+	LongType _beginCpuTime;			// 开始时的线程CPU时间，-1表示本次进入不统计，只由所属线程访问
+	bool _sampling;					// 本次进入是否计时，只由所属线程访问
+
+	PerformanceThreadSlot()
+		:_sequence(0)
+		, _beginTime(0)
+		, _costTime(0)
+		, _refCount(0)
+		, _callCount(0)
+		, _entryCount(0)
+		, _sampleCount(0)
+		, _sampleSquare(0)
+		, _minCostTime(0)
+		, _maxCostTime(0)
+		, _histogram(NULL)
+		, _cpuTime(0)
+		, _cpuWallTime(0)
+		, _counters(NULL)
+		, _allocCount(0)
+		, _allocBytes(0)
+		, _freeBytes(0)
+		, _peakLiveBytes(0)
+		, _liveBytes(0)
+		, _edges(NULL)
+		, _lastEdge(NULL)
+		, _sampleCountdown(0)
+		, _lastSampleTime(0)
+		, _beginCpuTime(-1)
+		, _sampling(false)
+	{}
+};
+
+// 所属线程更新槽位中的统计值
+inline void SlotAdd(atomic<LongType>& value, LongType delta)
+{
+	value.store(value.load(memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+//
+// 所属线程一次更新多个统计值时用顺序锁包围，读线程重读直到读到一致的快照。
+// 写入不会被读线程阻塞，只多两次本线程缓存行上的写。
+//
+inline void SlotWriteBegin(PerformanceThreadSlot* slot)
+{
+	slot->_sequence.store(slot->_sequence.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+inline void SlotWriteEnd(PerformanceThreadSlot* slot)
+{
+	slot->_sequence.store(slot->_sequence.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// 剖析段事件
+struct PerformanceTraceEvent
+{
+	LongType _time;		// 时间(时钟计数)
+	int _sectionId;		// 剖析段id
+	int _type;			// 事件类型
+};
+
+//
+// 线程事件环形缓冲区
+// 每次剖析段开始/结束记录一个事件，缓冲区大小固定，写满后覆盖最早的事件。
+// 只由所属线程写，每个事件用顺序号包围，读线程复制后重读顺序号，
+// 丢弃正在写入或已被覆盖的事件。
+//
+class PerformanceTraceBuffer
+{
+public:
+	enum
+	{
+		EVENT_COUNT = 1 << 16,	// 每个线程最多保存的事件数(1.5M内存)
+	};
+
+	enum
+	{
+		EVENT_BEGIN = 0,		// 剖析段开始
+		EVENT_END = 1,			// 剖析段结束
+	};
+
+	PerformanceTraceBuffer()
+		:_head(0)
+	{
+		for (int i = 0; i < EVENT_COUNT; ++i)
+		{
+			_events[i]._sequence.store(0, memory_order_relaxed);
+		}
+	}
+
+	// 所属线程记录事件，同SlotWriteBegin/SlotWriteEnd，写入前后各递增一次顺序号
+	void Record(int sectionId, int type)
+	{
+		LongType head = _head.load(memory_order_relaxed);
+		Event& event = _events[head & (EVENT_COUNT - 1)];
+		LongType sequence = event._sequence.load(memory_order_relaxed);
+		event._sequence.store(sequence + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+
+		event._time.store(TimeEngine::GetTicks(), memory_order_relaxed);
+		event._info.store(((LongType)sectionId << 1) | type, memory_order_relaxed);
+
+		event._sequence.store(sequence + 2, memory_order_release);
+		_head.store(head + 1, memory_order_release);
+	}
+
+	// 读取缓冲区中的事件，按时间先后顺序
+	void Read(vector<PerformanceTraceEvent>& events) const;
+private:
+	struct Event
+	{
+		atomic<LongType> _sequence;	// 顺序号，奇数表示正在写入，第index个事件写完后为(index / EVENT_COUNT + 1) * 2
+		atomic<LongType> _time;		// 时间
+		atomic<LongType> _info;		// 剖析段id << 1 | 事件类型
+	};
+
+	atomic<LongType> _head;			// 总写入的事件数
+	Event _events[EVENT_COUNT];		// 事件
+};
+
+//
+// 线程剖析段栈中的一帧，对应一次进入的剖析段
+//
+struct PerformanceFrame
+{
+	int _sectionId;					// 剖析段id
+	int _node;						// 调用路径节点id，不统计调用树时为-1
+	PerformanceThreadSlot* _slot;	// 剖析段在当前线程的槽位
+	PerformanceEdge* _edge;			// 进入时经过的调用树的边，不统计调用树时为NULL
+	LongType _beginTime;			// 开始时间，统计调用树时才计时
+	LongType _childTime;			// 子剖析段的花费时间
+};
+
+//
+// 线程剖析上下文
+// 每个线程第一次进入剖析段时创建，保存该线程在所有剖析段上的统计槽位。
+// 槽位按剖析段id分块分配，块指针只增不减，读线程可以无锁的查找槽位。
+// 同时维护当前线程的剖析段栈，记录剖析段之间的父子关系。
+// 线程退出时上下文被注销，没有读线程时合并到已退出线程的汇总上下文后释放。
+//
+class PerformanceThreadContext
+{
+public:
+	enum
+	{
+		SLOT_CHUNK_SIZE = 256,		// 每块的槽位数
+		SLOT_CHUNK_COUNT = 4096,	// 最大块数
+		MAX_FRAME_DEPTH = 256,		// 剖析段栈的最大深度，超过时丢弃整个栈
+	};
+
+	PerformanceThreadContext(int threadId);
+	~PerformanceThreadContext();
+
+	// 获取当前线程的剖析上下文
+	static PerformanceThreadContext* GetCurrent();
+
+	// 获取当前线程的剖析上下文，没有时返回NULL，不会注册(不分配内存)
+	static PerformanceThreadContext* FindCurrent();
+
+	// 所属线程获取剖析段的槽位，不存在时分配
+	PerformanceThreadSlot* GetSlot(int sectionId);
+
+	// 查找剖析段的槽位，不存在时返回NULL
+	PerformanceThreadSlot* FindSlot(int sectionId) const;
+
+	int GetThreadId() const
+	{
+		return _threadId;
+	}
+
+	// 所属线程获取随机数(xorshift)，用于随机采样
+	unsigned int Random()
+	{
+		_random ^= _random << 13;
+		_random ^= _random >> 7;
+		_random ^= _random << 17;
+		return (unsigned int)(_random >> 32);
+	}
+
+	// 进入剖析段，压入剖析段栈，统计调用树时查找调用路径对应的边
+	void PushFrame(int sectionId, PerformanceThreadSlot* slot, bool timed);
+
+	// 退出剖析段，弹出剖析段栈并更新调用树的边
+	void PopFrame(int sectionId, bool outermost);
+
+	// 剖析段栈是否为空，为空时退出剖析段不用弹栈
+	bool IsFrameEmpty() const
+	{
+		return _depth == 0;
+	}
+
+	// 没有记录到调用树中的帧数(首尾不匹配或超过最大深度时丢弃)
+	LongType GetDroppedFrames() const
+	{
+		return _droppedFrames.load(memory_order_relaxed);
+	}
+
+	// 所属线程记录剖析段事件，第一次记录时分配事件缓冲区
+	void Trace(int sectionId, int type);
+
+	// 获取事件缓冲区，没有记录过事件时返回NULL
+	const PerformanceTraceBuffer* GetTraceBuffer() const
+	{
+		return _traceBuffer.load(memory_order_acquire);
+	}
+
+	// 所属线程获取性能计数器组，第一次获取时打开
+	PerformanceCounterGroup* GetCounterGroup();
+
+	// 所属线程退出时关闭性能计数器组
+	void CloseCounterGroup();
+
+	// 把已退出线程的统计值累加到当前上下文，调用时没有线程读写这两个上下文
+	void Merge(const PerformanceThreadContext& other);
+
+	// 取出事件缓冲区，之后由调用者释放
+	PerformanceTraceBuffer* DetachTraceBuffer()
+	{
+		return _traceBuffer.exchange(NULL, memory_order_relaxed);
+	}
+
+	// 当前最内层的剖析段帧，没有时返回NULL
+	PerformanceFrame* GetTopFrame()
+	{
+		if (_depth <= 0)
+			return NULL;
+
+		return &_frames[_depth - 1];
+	}
+private:
+	// 所属线程查找剖析段槽位中父调用路径对应的边，不存在时创建
+	PerformanceEdge* _FindEdge(PerformanceThreadSlot* slot, int parentNode, int sectionId);
+
+	int _threadId;												// 线程id
+	unsigned long long _random;									// 随机数状态
+	int _depth;													// 剖析段栈的深度
+	PerformanceFrame _frames[MAX_FRAME_DEPTH];					// 剖析段栈
+	atomic<LongType> _droppedFrames;							// 丢弃的帧数
+	atomic<PerformanceTraceBuffer*> _traceBuffer;				// 事件缓冲区
+	PerformanceCounterGroup* _counterGroup;						// 性能计数器组
+	atomic<PerformanceThreadSlot*> _chunks[SLOT_CHUNK_COUNT];	// 槽位块
+};
+
+//
+// 堆内存分配统计
+// 定义PERFORMANCE_PROFILER_TRACK_ALLOC编译剖析器时接管内存分配函数(Linux下malloc/free系列，
+// Windows下operator new/delete)，开启PPCO_ALLOC选项后把分配/释放的字节数计入当前线程
+// 最内层的剖析段。只访问所属线程的剖析段栈和槽位，不加锁。
+//
+class PerformanceAllocTracker
+{
+public:
+	// 剖析器内部分配内存时暂停当前线程的统计，避免计入剖析段
+	class Pause
+	{
+	public:
+		Pause();
+		~Pause();
+	};
+
+	// 当前线程是否统计内存分配，不统计时接管的分配函数不用获取块大小
+	static bool IsTracking();
+
+	static void OnAlloc(size_t size);
+	static void OnFree(size_t size);
+};
+
+// 剖析段在一个线程上的统计信息
+struct PerformanceThreadStatistics
+{
+	int _threadId;			// 线程id
+	LongType _costTime;		// 花费时间(采样时为计时部分的花费时间)
+	LongType _callCount;	// 调用次数
+	LongType _entryCount;	// 最外层进入次数
+	LongType _sampleCount;	// 计时的次数
+	LongType _cpuTime;		// 线程CPU时间(纳秒)
+	LongType _cpuWallTime;	// 统计了CPU时间的那部分花费时间
+};
+
+// 调用树的边合并所有线程后的统计信息
+struct PerformanceEdgeStatistics
+{
+	int _parentNode;			// 父调用路径节点id，-1表示没有父剖析段
+	int _node;					// 调用路径节点id
+	LongType _callCount;		// 调用次数
+	LongType _inclusiveTime;	// 包含子剖析段的花费时间
+	LongType _exclusiveTime;	// 自身花费时间
+};
+
+// 合并所有线程后剖析段的统计信息
+struct PerformanceSectionStatistics
+{
+	vector<PerformanceThreadStatistics> _threads;	// 各线程的统计信息
+	vector<PerformanceEdgeStatistics> _edges;		// 以该剖析段为子节点的调用树的边
+	LongType _totalCostTime;						// 总花费时间
+	LongType _totalRef;								// 总的引用计数
+	LongType _totalCallCount;						// 总的调用次数
+
+	LongType _totalEntryCount;						// 总的最外层进入次数
+	LongType _totalSampleCount;						// 总的计时次数
+	LongType _estimatedCostTime;					// 按采样估算的总花费时间
+	LongType _errorBound;							// 估算的误差范围(95%置信度)
+
+	vector<LongType> _histogram;					// 合并后的延迟直方图，只保存最小到最大花费时间所在的桶
+	int _histogramBase;								// 合并直方图第一个桶的下标
+	LongType _minCostTime;							// 单次最小花费时间
+	LongType _maxCostTime;							// 单次最大花费时间
+	LongType _p99;									// p99延迟，用于排序
+	LongType _totalCpuTime;							// 总的线程CPU时间(纳秒)
+	LongType _totalCpuWallTime;						// 统计了CPU时间的那部分总花费时间
+	LongType _counters[PPCT_COUNT];					// 累计的性能计数
+	LongType _counterCount;							// 统计了计数器的进入次数
+	shared_ptr<ResourceSnapshot> _resource;			// 资源统计信息的快照，资源统计段才有
+	LongType _totalAllocCount;						// 总的内存分配次数
+	LongType _totalAllocBytes;						// 总的分配字节数
+	LongType _totalFreeBytes;						// 总的释放字节数
+	LongType _peakLiveBytes;						// 各线程未释放字节数峰值的最大值
+
+	PerformanceSectionStatistics()
+	{
+		Clear();
+	}
+
+	// 清空统计信息，保留vector的容量，多次输出报告时复用
+	void Clear()
+	{
+		_threads.clear();
+		_edges.clear();
+		_histogram.clear();
+		_resource.reset();
+
+		_totalCostTime = 0;
+		_totalRef = 0;
+		_totalCallCount = 0;
+		_totalEntryCount = 0;
+		_totalSampleCount = 0;
+		_estimatedCostTime = 0;
+		_errorBound = 0;
+		_histogramBase = 0;
+		_minCostTime = 0;
+		_maxCostTime = 0;
+		_p99 = 0;
+		_totalCpuTime = 0;
+		_totalCpuWallTime = 0;
+		_counterCount = 0;
+		_totalAllocCount = 0;
+		_totalAllocBytes = 0;
+		_totalFreeBytes = 0;
+		_peakLiveBytes = 0;
+
+		for (int i = 0; i < PPCT_COUNT; ++i)
+		{
+			_counters[i] = 0;
+		}
+	}
+
+	// 按合并后的直方图计算百分位延迟(时钟计数)，percent取值0~100
+	LongType GetPercentile(double percent) const;
+};
+
+class PerformanceProfilerScope;
+
+//
+// 性能剖析段
+//
+class API_EXPORT PerformanceProfilerSection
+{
+	friend class PerformanceProfiler;
+public:
+	PerformanceProfilerSection(int id)
+		:_id(id)
+		, _rsStatistics(0)
+		, _enable(true)
+		, _sampleMode(PPSM_NONE)
+		, _sampleRate(1)
+	{}
+
+	void Begin();
+	void End();
+
+	//
+	// 作用域剖析的开始和结束，由PerformanceProfilerScope的构造/析构调用。
+	// 开始和结束一定成对，线程槽位和开始时间保存在作用域对象中，不需要处理不匹配的情况。
+	//
+	void BeginScope(PerformanceProfilerScope& scope);
+	void EndScope(PerformanceProfilerScope& scope);
+
+	// 剖析段是否开启
+	bool IsEnable() const
+	{
+		return _enable.load(memory_order_relaxed);
+	}
+
+	// 应用剖析段配置
+	void ApplyConfig(const SectionConfig& config);
+
+	// 合并各线程槽位中的统计信息
+	void Statistics(const vector<PerformanceThreadContext*>& contexts,
+		PerformanceSectionStatistics& statistics) const;
+
+	void Serialize(OutputBuffer& OB, const PerformanceSectionStatistics& statistics);
+
+	// 序列化为JSON对象的成员
+	void SerializeJson(OutputBuffer& OB, const PerformanceSectionStatistics& statistics);
+
+	// 序列化为CSV，一行剖析段汇总，每个线程一行明细
+	void SerializeCsv(OutputBuffer& OB, const PerformanceNode& node,
+		const PerformanceSectionStatistics& statistics);
 private:
-	mutex _mutex;					// 
-	StatisMap _beginTimeMap;		// ʼʱͳ
-	StatisMap _costTimeMap;			// ʱͳ
-	LongType _totalCostTime;		// ܻʱ
+	// 判断本次进入剖析段是否计时
+	bool _IsSampling(PerformanceThreadSlot* slot, PerformanceThreadContext* context);
+
+	// 记录单次花费时间的延迟分布
+	void _RecordLatency(PerformanceThreadSlot* slot, LongType costTime);
+
+	// 记录单次占用的线程CPU时间，beginCpuTime < 0时本次进入不统计
+	void _RecordCpuTime(PerformanceThreadSlot* slot, LongType beginCpuTime, LongType costTime);
+
+	// 进入/退出时读取性能计数器，退出时累计差值
+	void _BeginCounters(PerformanceThreadSlot* slot, PerformanceThreadContext* context);
+	void _EndCounters(PerformanceThreadSlot* slot, PerformanceThreadContext* context);
 
-	StatisMap _refCountMap;			// ü(βƥ䣬ݹ麯ڲ)
-	LongType _totalRef;				// ܵü
+	// 序列化性能计数器
+	void _SerializeCounters(OutputBuffer& OB, const PerformanceSectionStatistics& statistics);
 
-	StatisMap _callCountMap;		// ôͳ
-	LongType _totalCallCount;		// ܵĵô
+	// 序列化IO统计
+	void _SerializeIO(OutputBuffer& OB, const ResourceSnapshot& snapshot,
+		const PerformanceSectionStatistics& statistics);
 
-	ResourceStatistics* _rsStatistics;	// Դͳ̶߳
+	// 序列化内存分配统计
+	void _SerializeAlloc(OutputBuffer& OB, const PerformanceSectionStatistics& statistics);
+
+	// 序列化CPU时间和阻塞时间
+	void _SerializeCpuTime(OutputBuffer& OB, LongType cpuTime, LongType cpuWallTime);
+
+	int _id;							// 剖析段id，对应线程上下文中的槽位
+	ResourceStatistics* _rsStatistics;	// 资源统计线程对象
+	atomic<bool> _enable;				// 剖析段是否开启
+	atomic<int> _sampleMode;			// 采样方式
+	atomic<LongType> _sampleRate;		// 采样率N，或者采样时间间隔(时钟计数)
+};
+
+//
+// 作用域剖析对象，构造时开始剖析，析构时结束剖析。
+// 提前返回和抛出异常时也能正确结束，不会出现剖析段不匹配。
+//
+class PerformanceProfilerScope
+{
+	friend class PerformanceProfilerSection;
+public:
+	PerformanceProfilerScope(PerformanceProfilerSection* section)
+		:_section(section)
+		, _context(NULL)
+		, _slot(NULL)
+		, _beginTime(0)
+		, _beginCpuTime(-1)
+		, _outermost(false)
+		, _timed(false)
+	{
+		if (_section && _section->IsEnable())
+		{
+			_section->BeginScope(*this);
+		}
+	}
+
+	~PerformanceProfilerScope()
+	{
+		if (_slot)
+		{
+			_section->EndScope(*this);
+		}
+	}
+private:
+	PerformanceProfilerScope(const PerformanceProfilerScope&);
+	PerformanceProfilerScope& operator=(const PerformanceProfilerScope&);
+
+	PerformanceProfilerSection* _section;	// 剖析段
+	PerformanceThreadContext* _context;		// 当前线程的剖析上下文
+	PerformanceThreadSlot* _slot;			// 剖析段在当前线程的槽位，开始成功时不为NULL
+	LongType _beginTime;					// 开始时间(时钟计数)
+	LongType _beginCpuTime;					// 开始时的线程CPU时间，-1表示不统计
+	bool _outermost;						// 是否最外层进入(非递归进入)
+	bool _timed;							// 本次进入是否计时
 };
 
 class API_EXPORT PerformanceProfiler : public Singleton<PerformanceProfiler>
@@ -442,87 +1676,388 @@ public:
 	friend class Singleton<PerformanceProfiler>;
 
 	//
-	// unordered_mapڲʹhash_tableʵ֣ʱ临ӶΪmapڲʹú
-	// unordered_mapʱ临ӶΪO(1)mapΪO(lgN)so! unordered_mapЧ
+	// unordered_map内部使用hash_table实现（时间复杂度为），map内部使用红黑树。
+	// unordered_map操作的时间复杂度为O(1)，map为O(lgN)，so! unordered_map更高效。
 	// http://blog.chinaunix.net/uid-20384806-id-3055333.html
 	//
 	typedef unordered_map<PerformanceNode, PerformanceProfilerSection*, PerformanceNodeHash> PerformanceProfilerMap;
 	//typedef map<PerformanceNode, PerformanceProfilerSection*> PerformanceProfilerMap;
 
 	//
-	// 
+	// 创建剖析段
 	//
 	PerformanceProfilerSection* CreateSection(const char* fileName,
 		const char* funcName, int line, const char* desc, bool isStatistics);
 
 	static void OutPut();
-protected:
 
-	static bool CompareByCallCount(PerformanceProfilerMap::iterator lhs,
-		PerformanceProfilerMap::iterator rhs);
-	static bool CompareByCostTime(PerformanceProfilerMap::iterator lhs,
-		PerformanceProfilerMap::iterator rhs);
+	// 按格式输出剖析报告到保存适配器，如IPC回复
+	void OutPutReport(SaveAdapter& SA, PP_REPORT_FORMAT format);
+
+	// 输出Chrome Trace Event格式的事件时间线
+	static void OutPutTrace();
+
+	// 注册当前线程的剖析上下文
+	PerformanceThreadContext* RegisterThreadContext();
+
+	// 注销已退出线程的剖析上下文，没有读线程时合并后释放
+	void UnregisterThreadContext(PerformanceThreadContext* context);
+
+	//
+	// 获取父调用路径节点下剖析段的调用路径节点，不存在时分配。
+	// 只在线程第一次经过某条调用路径时调用，递归进入路径上已有的剖析段时返回该祖先节点。
+	//
+	int GetCallPathNode(int parentNode, int sectionId);
+
+	// 序列化各资源统计段最近的资源信息
+	void SerializeResourceState(SaveAdapter& SA);
+
+	// 对描述或"文件名:行号"匹配key的剖析段应用配置，返回匹配的个数
+	int ApplySectionConfig(const string& key, const SectionConfig& config);
+
+	// 输出各剖析段从上一次周期报告到现在的增量统计
+	void OutPutInterval(SaveAdapter& SA);
+
+	// 把各剖析段合并后的统计值发布到共享内存区
+	void OutPutSharedMemory(PerformanceSharedMemoryHeader& header);
+protected:
+	// 剖析段及合并后的统计信息
+	struct SectionReport
+	{
+		const PerformanceNode* _node;			// 剖析节点，创建后不会删除和移动
+		PerformanceProfilerSection* _section;	// 剖析段
+		PerformanceSectionStatistics _statistics;
+	};
+
+	static bool CompareByCallCount(const SectionReport* lhs,
+		const SectionReport* rhs);
+	static bool CompareByCostTime(const SectionReport* lhs,
+		const SectionReport* rhs);
+	static bool CompareByP99(const SectionReport* lhs,
+		const SectionReport* rhs);
 
 	PerformanceProfiler();
 
-	// лϢ
-	void _OutPut(SaveAdapter& SA);
+	// 按格式输出序列化信息
+	void _OutPut(SaveAdapter& SA, PP_REPORT_FORMAT format = PPRF_TEXT);
+
+	// 合并统计信息并按配置排序，结果保存在_reports中
+	void _Statistics(vector<SectionReport*>& vInfos);
+
+	// 按各种格式序列化剖析报告
+	void _OutPutText(OutputBuffer& OB, const vector<SectionReport*>& vInfos);
+	void _OutPutJson(OutputBuffer& OB, const vector<SectionReport*>& vInfos);
+	void _OutPutCsv(OutputBuffer& OB, const vector<SectionReport*>& vInfos);
+	void _OutPutSnapshot(OutputBuffer& OB, const vector<SectionReport*>& vInfos);
+
+	// 输出事件时间线
+	void _OutPutTrace(SaveAdapter& SA);
+
+	//
+	// 复制所有线程的剖析上下文，Release之前已退出线程的上下文不会被合并释放，
+	// 读线程可以在锁外读取复制的上下文。
+	//
+	void _AcquireThreadContexts(vector<PerformanceThreadContext*>& contexts);
+	void _ReleaseThreadContexts();
+
+	// 合并已退出线程的剖析上下文，调用时持有_threadMutex且没有读线程
+	void _MergeRetiredContexts();
+
+	// 调用树中每个调用路径节点的子节点(子剖析段id, 边)，按父节点id+1索引
+	typedef vector<vector<pair<int, const PerformanceEdgeStatistics*> > > CallTreeChildren;
+
+	// 输出调用树
+	void _OutPutCallTree(SaveAdapter& SA, const vector<SectionReport>& reports);
+	void _OutPutCallTreeNode(SaveAdapter& SA, const vector<const SectionReport*>& idReports,
+		const CallTreeChildren& children, int parentNode, vector<int>& path);
+
+	// 剖析段在上一次周期报告时的累计值，本次的累计值减去它即为周期内的增量
+	struct IntervalBase
+	{
+		LongType _callCount;			// 调用次数
+		LongType _sampleCount;			// 计时次数
+		LongType _costTime;				// 估算的总花费时间
+		LongType _cpuTime;				// 线程CPU时间
+		LongType _cpuWallTime;			// 统计了CPU时间的那部分花费时间
+		int _histogramBase;				// 直方图第一个桶的下标
+		vector<LongType> _histogram;	// 延迟直方图
+
+		IntervalBase()
+			:_callCount(0)
+			, _sampleCount(0)
+			, _costTime(0)
+			, _cpuTime(0)
+			, _cpuWallTime(0)
+			, _histogramBase(0)
+		{}
+	};
+
+	// 周期内有调用的剖析段
+	struct IntervalReport
+	{
+		const SectionReport* _report;
+		LongType _callCount;
+		LongType _sampleCount;
+		LongType _costTime;
+		LongType _cpuTime;
+		LongType _cpuWallTime;
+		PerformanceSectionStatistics _statistics;	// 只有直方图和最小/最大值，用于计算百分位
+	};
+
+	// 计算剖析段周期内的增量，并把当前累计值保存为下一周期的基准
+	void _Delta(const SectionReport& report, IntervalBase& base, IntervalReport& delta);
+
+	static bool CompareIntervalByCostTime(const IntervalReport* lhs,
+		const IntervalReport* rhs);
 private:
 	time_t  _beginTime;
+	LongType _beginTicks;	// 剖析开始的时钟计数，事件时间线的起点
 	mutex _mutex;
 	PerformanceProfilerMap _ppMap;
+
+	mutex _threadMutex;								// 线程上下文锁
+	vector<PerformanceThreadContext*> _threadContexts;	// 所有线程的剖析上下文
+	vector<PerformanceThreadContext*> _retiredContexts;	// 已退出等待合并的线程上下文
+	PerformanceThreadContext* _retiredContext;			// 已退出线程的汇总上下文，线程id为0
+	vector<pair<int, PerformanceTraceBuffer*> > _retiredTraces;	// 最近退出的线程的事件缓冲区
+	int _threadContextReaders;							// 正在读取线程上下文的读线程数
+	LongType _droppedFrameCount;						// 合并后未记录到调用树中的帧数
+
+	mutex _callPathMutex;								// 调用路径锁
+	vector<pair<int, int> > _callPathNodes;				// 调用路径节点(父节点id, 剖析段id)
+	unordered_map<LongType, int> _callPathMap;			// (父节点id + 1) << 32 | 剖析段id -> 节点id
+
+	mutex _outputMutex;				// 输出锁，保护下面复用的缓冲区
+	OutputBuffer _outputBuffer;		// 报告输出缓冲区，多次输出之间复用
+	vector<SectionReport> _reports;	// 合并后的统计信息，多次输出之间复用
+
+	vector<IntervalBase> _intervalBases;		// 各剖析段上一周期的累计值，按剖析段id索引
+	vector<IntervalReport> _intervalReports;	// 周期内有调用的剖析段，多次输出之间复用
+	LongType _intervalTicks;					// 上一次周期报告的时钟计数
+};
+
+//
+// 剖析段调用点
+// 每个剖析段开始宏展开处定义一个静态的调用点对象，第一次执行时通过CreateSection
+// 查找/创建剖析段并缓存到调用点中，之后直接使用缓存的剖析段，不再构造剖析节点、
+// 计算hash和加全局锁。
+// ps：调用点为聚合类型，使用常量初始化，不依赖局部静态变量初始化的线程安全。
+//
+struct PerformanceCallSite
+{
+	const char* _fileName;	// 文件名
+	const char* _function;	// 函数名
+	int	_line;				// 行号
+	const char* _desc;		// 附加描述
+	bool _isStatistics;		// 是否统计资源
+
+	atomic<PerformanceProfilerSection*> _section;	// 缓存的剖析段
+
+	PerformanceProfilerSection* GetSection()
+	{
+		PerformanceProfilerSection* section = _section.load(memory_order_acquire);
+		if (section == NULL)
+		{
+			//
+			// 多个线程同时第一次执行时可能都进入这里，CreateSection内部
+			// 按剖析节点去重，得到的是同一个剖析段，重复缓存没有问题。
+			//
+			section = PerformanceProfiler::GetInstance()->CreateSection(
+				_fileName, _function, _line, _desc, _isStatistics);
+			_section.store(section, memory_order_release);
+		}
+
+		return section;
+	}
 };
 
-// οʼ
-#define ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(sign, desc, isStatistics) \
+//
+// 剖析类别，按位组合，用户可以按模块定义自己的类别(PPC_DEFAULT以外的位)。
+//
+enum PP_CATEGORY
+{
+	PPC_DEFAULT = 1,	// 默认类别，不带类别的剖析段宏使用
+	PPC_ALL = -1,		// 所有类别
+};
+
+//
+// 编译期剖析开关
+// 1.定义PERFORMANCE_PROFILER_DISABLE时，所有剖析段宏展开为空，不产生任何代码。
+// 2.PERFORMANCE_PROFILER_CATEGORY_MASK为编译单元开启的剖析类别掩码，可在包含本头文件
+// 之前定义。类别不在掩码中的剖析段判断条件是编译期常量false，优化后不产生任何代码，
+// 这样延迟敏感的模块可以关闭剖析，其他模块继续剖析。
+//
+#ifndef PERFORMANCE_PROFILER_CATEGORY_MASK
+#define PERFORMANCE_PROFILER_CATEGORY_MASK PPC_ALL
+#endif
+
+#ifdef PERFORMANCE_PROFILER_DISABLE
+
+#define ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(category, sign, desc, isStatistics)
+#define ADD_PERFORMANCE_PROFILE_SECTION_END(sign)
+#define ADD_PERFORMANCE_PROFILE_SCOPE(category, line, desc, isStatistics)
+
+#else
+
+// 添加性能剖析段开始
+#define ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(category, sign, desc, isStatistics) \
 	PerformanceProfilerSection* PPS_##sign = NULL;						\
-	if (ConfigManager::GetInstance()->GetOptions()&PPCO_PROFILER)		\
+	if (((PERFORMANCE_PROFILER_CATEGORY_MASK) & (category))				\
+		&& ConfigManager::IsProfilerEnable())							\
 	{																	\
-		PPS_##sign = PerformanceProfiler::GetInstance()->CreateSection(__FILE__, __FUNCTION__, __LINE__, desc, isStatistics);\
-		PPS_##sign->Begin(GetThreadId());								\
+		static PerformanceCallSite PPCS_##sign =						\
+			{ __FILE__, __FUNCTION__, __LINE__, desc, isStatistics, { NULL } };	\
+		PerformanceProfilerSection* section = PPCS_##sign.GetSection();	\
+		if (section->IsEnable())										\
+		{																\
+			PPS_##sign = section;										\
+			PPS_##sign->Begin();										\
+		}																\
 	}
 
-// ν
+// 添加性能剖析段结束
 #define ADD_PERFORMANCE_PROFILE_SECTION_END(sign)	\
 	do{												\
 		if(PPS_##sign)								\
-			PPS_##sign->End(GetThreadId());			\
+			PPS_##sign->End();						\
 	}while(0);
 
+// 添加作用域性能剖析段，@line展开为行号后构造唯一的变量名
+#define ADD_PERFORMANCE_PROFILE_SCOPE(category, line, desc, isStatistics)	\
+	_ADD_PERFORMANCE_PROFILE_SCOPE(category, line, desc, isStatistics)
+
+#define _ADD_PERFORMANCE_PROFILE_SCOPE(category, line, desc, isStatistics)	\
+	static PerformanceCallSite PPCS_Scope##line =							\
+		{ __FILE__, __FUNCTION__, __LINE__, desc, isStatistics, { NULL } };	\
+	PerformanceProfilerScope PPSG_Scope##line(								\
+		((PERFORMANCE_PROFILER_CATEGORY_MASK) & (category))					\
+		&& ConfigManager::IsProfilerEnable()								\
+		? PPCS_Scope##line.GetSection() : NULL)
+
+#endif // PERFORMANCE_PROFILER_DISABLE
+
 //
-// Чʡʼ
-// @signΨһʶΨһα
-// @desc
+// 剖析【效率】开始
+// @sign是剖析段唯一标识，构造出唯一的剖析段变量
+// @desc是剖析段描述
 //
 #define PERFORMANCE_PROFILER_EE_BEGIN(sign, desc)	\
-	ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(sign, desc, false)
+	ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(PPC_DEFAULT, sign, desc, false)
 
 //
-// Чʡ
-// @signΨһʶ
+// 剖析【效率】结束
+// @sign是剖析段唯一标识
 //
 #define PERFORMANCE_PROFILER_EE_END(sign)	\
 	ADD_PERFORMANCE_PROFILE_SECTION_END(sign)
 
 //
-// Ч&Դʼ
-// psǱԴͳƶΣΪÿԴͳƶζῪһ߳̽ͳ
-// @signΨһʶΨһα
-// @desc
+// 剖析【效率&资源】开始。
+// ps：所有资源统计段共用一个采样线程，统计的是整个进程的资源
+// @sign是剖析段唯一标识，构造出唯一的剖析段变量
+// @desc是剖析段描述
 //
 #define PERFORMANCE_PROFILER_EE_RS_BEGIN(sign, desc)	\
-	ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(sign, desc, true)
+	ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(PPC_DEFAULT, sign, desc, true)
 
 //
-// Ч&Դ
-// psǱԴͳƶΣΪÿԴͳƶζῪһ߳̽ͳ
-// @signΨһʶ
+// 剖析【效率&资源】结束
+// ps：所有资源统计段共用一个采样线程，统计的是整个进程的资源
+// @sign是剖析段唯一标识
 //
 #define PERFORMANCE_PROFILER_EE_RS_END(sign)		\
 	ADD_PERFORMANCE_PROFILE_SECTION_END(sign)
 
 //
-// ѡ
+// 按类别剖析【效率】开始
+// @category是剖析段类别(PP_CATEGORY)，不在编译单元的类别掩码中时不做剖析
+// @sign是剖析段唯一标识，构造出唯一的剖析段变量
+// @desc是剖析段描述
+//
+#define PERFORMANCE_PROFILER_EE_CATEGORY_BEGIN(category, sign, desc)	\
+	ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(category, sign, desc, false)
+
+//
+// 按类别剖析【效率】结束
+// @sign是剖析段唯一标识
+//
+#define PERFORMANCE_PROFILER_EE_CATEGORY_END(sign)	\
+	ADD_PERFORMANCE_PROFILE_SECTION_END(sign)
+
+//
+// 按类别剖析【效率&资源】开始
+// @category是剖析段类别(PP_CATEGORY)，不在编译单元的类别掩码中时不做剖析
+// @sign是剖析段唯一标识，构造出唯一的剖析段变量
+// @desc是剖析段描述
+//
+#define PERFORMANCE_PROFILER_EE_RS_CATEGORY_BEGIN(category, sign, desc)	\
+	ADD_PERFORMANCE_PROFILE_SECTION_BEGIN(category, sign, desc, true)
+
+//
+// 按类别剖析【效率&资源】结束
+// @sign是剖析段唯一标识
+//
+#define PERFORMANCE_PROFILER_EE_RS_CATEGORY_END(sign)	\
+	ADD_PERFORMANCE_PROFILE_SECTION_END(sign)
+
+//
+// 剖析当前作用域的【效率】，离开作用域时自动结束
+// @desc是剖析段描述
+//
+#define PERFORMANCE_PROFILER_SCOPE(desc)	\
+	ADD_PERFORMANCE_PROFILE_SCOPE(PPC_DEFAULT, __LINE__, desc, false)
+
+//
+// 剖析当前作用域的【效率&资源】，离开作用域时自动结束
+// @desc是剖析段描述
+//
+#define PERFORMANCE_PROFILER_RS_SCOPE(desc)	\
+	ADD_PERFORMANCE_PROFILE_SCOPE(PPC_DEFAULT, __LINE__, desc, true)
+
+//
+// 按类别剖析当前作用域的【效率】，离开作用域时自动结束
+// @category是剖析段类别(PP_CATEGORY)
+// @desc是剖析段描述
+//
+#define PERFORMANCE_PROFILER_CATEGORY_SCOPE(category, desc)	\
+	ADD_PERFORMANCE_PROFILE_SCOPE(category, __LINE__, desc, false)
+
+//
+// 设置剖析选项
 //
 #define SET_PERFORMANCE_PROFILER_OPTIONS(flag)		\
 	ConfigManager::GetInstance()->SetOptions(flag)
+
+
+//
+// 设置剖析段的采样方式
+// @key是剖析段描述或"文件名:行号"
+// @mode是采样方式(PP_SAMPLE_MODE)
+// @rate是采样率N，或者采样时间间隔(微秒)
+//
+#define SET_PERFORMANCE_PROFILER_SECTION_SAMPLING(key, mode, rate)	\
+	ConfigManager::GetInstance()->SetSectionSampling(key, mode, rate)
+
+//
+// 设置计时源(PP_TIME_SOURCE)，需在第一个剖析段之前设置
+//
+#define SET_PERFORMANCE_PROFILER_TIME_SOURCE(source)	\
+	ConfigManager::GetInstance()->SetTimeSource(source)
+
+//
+// 设置周期报告的时间间隔(秒)，0表示停止周期报告
+//
+#define SET_PERFORMANCE_PROFILER_REPORT_INTERVAL(seconds)	\
+	PerformanceReporter::GetInstance()->SetInterval(seconds)
+
+//
+// 设置周期报告文件的大小上限(字节)和轮转保留的旧文件个数
+//
+#define SET_PERFORMANCE_PROFILER_REPORT_ROTATION(maxFileSize, maxFileCount)	\
+	PerformanceReporter::GetInstance()->SetRotation(maxFileSize, maxFileCount)
+
+//
+// 设置发布统计值到共享内存区的时间间隔(毫秒)，0表示停止发布
+//
+#define SET_PERFORMANCE_PROFILER_SHARED_MEMORY(milliseconds)	\
+	PerformancePublisher::GetInstance()->SetInterval(milliseconds)
@@ -0,0 +1,333 @@
+/******************************************************************************************
+PerformanceSharedMemory.h
+Copyright (c) Bit Software, Inc.(2015), All rights reserved.
+
+Purpose: 剖析统计的共享内存区格式，以及只读映射的共享内存读取器
+******************************************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+
+#ifdef _WIN32
+	#include<Windows.h>
+#else
+	#include<unistd.h>
+	#include<fcntl.h>
+	#include<sys/mman.h>
+	#include<sys/stat.h>
+#endif
+
+typedef long long LongType;
+
+//
+// 共享内存区由文件头和定长的剖析段记录表组成，记录按剖析段id索引。
+// 被剖析进程的发布线程周期性地把合并后的统计值写入记录，每个记录用顺序锁保护，
+// 读取方只读映射后重读直到读到一致的统计值，不需要和被剖析进程交互，也不阻塞它。
+// 剖析段记录只增加不删除，新记录的名字写好后才增加文件头中的记录数。
+// ps：Linux下位于/dev/shm/performance_profiler_<pid>，Windows下为命名的文件映射。
+//
+enum
+{
+	PP_SHARED_MEMORY_VERSION = 1,		// 共享内存格式版本
+	PP_SHARED_MEMORY_CAPACITY = 4096,	// 剖析段记录容量，超出的剖析段不发布
+	PP_SHARED_MEMORY_NAME_SIZE = 64,	// 记录中名字的最大长度(含'\0')，超出的截断
+	PP_SHARED_MEMORY_MAX_RETRY = 100,	// 读取时顺序锁最大重读次数
+	PP_SHARED_MEMORY_MAX_RECORD_SIZE = 4096,	// 读取时允许的最大文件头/记录大小
+};
+
+// 共享内存区标识
+static const char PP_SHARED_MEMORY_MAGIC[4] = { 'P', 'P', 'S', 'M' };
+
+// 共享内存区名字
+inline void GetSharedMemoryName(int processId, char* name)
+{
+#ifdef _WIN32
+	sprintf(name, "Local\\PerformanceProfiler_%d", processId);
+#else
+	sprintf(name, "/performance_profiler_%d", processId);
+#endif
+}
+
+// 文件头
+struct PerformanceSharedMemoryHeader
+{
+	char _magic[4];							// 标识"PPSM"，其他字段初始化完成后才写入
+	unsigned int _version;					// 格式版本
+	unsigned int _headerSize;				// 文件头大小(记录表的偏移)
+	unsigned int _sectionSize;				// 剖析段记录大小
+	unsigned int _capacity;					// 剖析段记录容量
+	int _processId;							// 进程id
+	std::atomic<unsigned int> _sectionCount;	// 已发布的剖析段记录数
+	std::atomic<unsigned int> _droppedCount;	// 超出容量未发布的剖析段数
+	LongType _beginTime;					// 剖析开始时间(time_t)
+	std::atomic<LongType> _updateTime;		// 最近一次发布的时间(毫秒，time_t * 1000)
+	std::atomic<LongType> _updateCount;		// 发布次数，不再增加说明进程已停止发布
+};
+
+// 剖析段的统计值，时间为纳秒
+struct PerformanceSharedMemoryStatistics
+{
+	LongType _callCount;			// 总调用次数
+	LongType _entryCount;			// 最外层进入次数
+	LongType _sampleCount;			// 计时次数
+	LongType _costTime;				// 估算的总花费时间
+	LongType _minCostTime;			// 单次最小花费时间
+	LongType _maxCostTime;			// 单次最大花费时间
+	LongType _p50;					// p50延迟
+	LongType _p90;					// p90延迟
+	LongType _p99;					// p99延迟
+	LongType _cpuTime;				// 线程CPU时间
+	LongType _cpuWallTime;			// 统计了CPU时间的那部分花费时间
+	LongType _allocCount;			// 内存分配次数
+	LongType _allocBytes;			// 分配字节数
+};
+
+//
+// 共享内存中的统计值，字段为原子变量，发布线程和读取方同时访问时行为是确定的。
+// 一致性由记录的顺序锁保证，字段本身只需要relaxed读写。
+//
+struct PerformanceSharedMemoryAtomicStatistics
+{
+	std::atomic<LongType> _callCount;
+	std::atomic<LongType> _entryCount;
+	std::atomic<LongType> _sampleCount;
+	std::atomic<LongType> _costTime;
+	std::atomic<LongType> _minCostTime;
+	std::atomic<LongType> _maxCostTime;
+	std::atomic<LongType> _p50;
+	std::atomic<LongType> _p90;
+	std::atomic<LongType> _p99;
+	std::atomic<LongType> _cpuTime;
+	std::atomic<LongType> _cpuWallTime;
+	std::atomic<LongType> _allocCount;
+	std::atomic<LongType> _allocBytes;
+
+	void Store(const PerformanceSharedMemoryStatistics& statistics)
+	{
+		_callCount.store(statistics._callCount, std::memory_order_relaxed);
+		_entryCount.store(statistics._entryCount, std::memory_order_relaxed);
+		_sampleCount.store(statistics._sampleCount, std::memory_order_relaxed);
+		_costTime.store(statistics._costTime, std::memory_order_relaxed);
+		_minCostTime.store(statistics._minCostTime, std::memory_order_relaxed);
+		_maxCostTime.store(statistics._maxCostTime, std::memory_order_relaxed);
+		_p50.store(statistics._p50, std::memory_order_relaxed);
+		_p90.store(statistics._p90, std::memory_order_relaxed);
+		_p99.store(statistics._p99, std::memory_order_relaxed);
+		_cpuTime.store(statistics._cpuTime, std::memory_order_relaxed);
+		_cpuWallTime.store(statistics._cpuWallTime, std::memory_order_relaxed);
+		_allocCount.store(statistics._allocCount, std::memory_order_relaxed);
+		_allocBytes.store(statistics._allocBytes, std::memory_order_relaxed);
+	}
+
+	void Load(PerformanceSharedMemoryStatistics& statistics) const
+	{
+		statistics._callCount = _callCount.load(std::memory_order_relaxed);
+		statistics._entryCount = _entryCount.load(std::memory_order_relaxed);
+		statistics._sampleCount = _sampleCount.load(std::memory_order_relaxed);
+		statistics._costTime = _costTime.load(std::memory_order_relaxed);
+		statistics._minCostTime = _minCostTime.load(std::memory_order_relaxed);
+		statistics._maxCostTime = _maxCostTime.load(std::memory_order_relaxed);
+		statistics._p50 = _p50.load(std::memory_order_relaxed);
+		statistics._p90 = _p90.load(std::memory_order_relaxed);
+		statistics._p99 = _p99.load(std::memory_order_relaxed);
+		statistics._cpuTime = _cpuTime.load(std::memory_order_relaxed);
+		statistics._cpuWallTime = _cpuWallTime.load(std::memory_order_relaxed);
+		statistics._allocCount = _allocCount.load(std::memory_order_relaxed);
+		statistics._allocBytes = _allocBytes.load(std::memory_order_relaxed);
+	}
+};
+
+// 原子变量和普通字段大小相同，共享内存的布局不变
+static_assert(sizeof(PerformanceSharedMemoryAtomicStatistics) == sizeof(PerformanceSharedMemoryStatistics),
+	"shared memory statistics layout");
+
+// 剖析段记录
+struct PerformanceSharedMemorySection
+{
+	std::atomic<unsigned int> _sequence;	// 顺序锁，奇数表示正在更新统计值
+	int _id;								// 剖析段id
+	int _line;								// 行号
+	int _reserved;
+	char _desc[PP_SHARED_MEMORY_NAME_SIZE];		// 附加描述
+	char _fileName[PP_SHARED_MEMORY_NAME_SIZE];	// 文件名
+	char _function[PP_SHARED_MEMORY_NAME_SIZE];	// 函数名
+	PerformanceSharedMemoryAtomicStatistics _statistics;
+};
+
+// 文件头按缓存行对齐后的大小
+inline size_t GetSharedMemoryHeaderSize()
+{
+	return (sizeof(PerformanceSharedMemoryHeader) + 63) & ~(size_t)63;
+}
+
+// 共享内存区大小
+inline size_t GetSharedMemorySize(unsigned int capacity)
+{
+	return GetSharedMemoryHeaderSize() + capacity * sizeof(PerformanceSharedMemorySection);
+}
+
+//
+// 共享内存读取器
+// 只读映射被剖析进程的共享内存区，读取统计值时按顺序锁重读。
+//
+class PerformanceSharedMemoryReader
+{
+public:
+	PerformanceSharedMemoryReader()
+		:_data(NULL)
+		, _size(0)
+#ifdef _WIN32
+		, _hMapping(NULL)
+#endif
+	{}
+
+	~PerformanceSharedMemoryReader()
+	{
+		Close();
+	}
+
+	bool Open(int processId)
+	{
+		Close();
+
+		char name[64];
+		GetSharedMemoryName(processId, name);
+
+#ifdef _WIN32
+		_hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+		if (_hMapping == NULL)
+			return false;
+
+		_data = (const char*)MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0);
+
+		MEMORY_BASIC_INFORMATION info;
+		if (_data && VirtualQuery(_data, &info, sizeof(info)))
+			_size = info.RegionSize;
+#else
+		int fd = shm_open(name, O_RDONLY, 0);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (data == MAP_FAILED)
+			return false;
+
+		_data = (const char*)data;
+		_size = st.st_size;
+#endif
+
+		if (_data == NULL || !_Validate())
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (_data)
+			UnmapViewOfFile(_data);
+		if (_hMapping)
+			CloseHandle(_hMapping);
+
+		_hMapping = NULL;
+#else
+		if (_data)
+			munmap((void*)_data, _size);
+#endif
+
+		_data = NULL;
+		_size = 0;
+	}
+
+	const PerformanceSharedMemoryHeader& GetHeader() const
+	{
+		return *(const PerformanceSharedMemoryHeader*)_data;
+	}
+
+	// 已发布的剖析段记录数
+	unsigned int GetSectionCount() const
+	{
+		const PerformanceSharedMemoryHeader& header = GetHeader();
+		unsigned int count = header._sectionCount.load(std::memory_order_acquire);
+		return count < header._capacity ? count : header._capacity;
+	}
+
+	// 剖析段记录，名字发布后不再修改，可以直接读取
+	const PerformanceSharedMemorySection& GetSection(unsigned int index) const
+	{
+		const PerformanceSharedMemoryHeader& header = GetHeader();
+		return *(const PerformanceSharedMemorySection*)(_data
+			+ header._headerSize + (size_t)index * header._sectionSize);
+	}
+
+	//
+	// 按顺序锁读取剖析段一致的统计值，发布线程正在更新时重读，
+	// 重读多次仍不一致时返回false。
+	//
+	bool ReadStatistics(unsigned int index, PerformanceSharedMemoryStatistics& statistics) const
+	{
+		const PerformanceSharedMemorySection& section = GetSection(index);
+		for (int retry = 0; retry < PP_SHARED_MEMORY_MAX_RETRY; ++retry)
+		{
+			unsigned int sequence = section._sequence.load(std::memory_order_acquire);
+			section._statistics.Load(statistics);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if ((sequence & 1) == 0 && sequence == section._sequence.load(std::memory_order_relaxed))
+				return true;
+		}
+
+		return false;
+	}
+private:
+	// 校验文件头和记录表的范围
+	bool _Validate() const
+	{
+		if (_size < sizeof(PerformanceSharedMemoryHeader))
+			return false;
+
+		const PerformanceSharedMemoryHeader& header = GetHeader();
+		if (memcmp(header._magic, PP_SHARED_MEMORY_MAGIC, sizeof(PP_SHARED_MEMORY_MAGIC)) != 0)
+			return false;
+
+		// 标识在其他字段之后写入，读到标识后其他字段都已初始化
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (header._version < 1
+			|| header._headerSize < sizeof(PerformanceSharedMemoryHeader)
+			|| header._sectionSize < sizeof(PerformanceSharedMemorySection)
+			|| header._headerSize > PP_SHARED_MEMORY_MAX_RECORD_SIZE
+			|| header._sectionSize > PP_SHARED_MEMORY_MAX_RECORD_SIZE
+			|| header._headerSize % 8 || header._sectionSize % 8
+			|| header._headerSize > _size)
+			return false;
+
+		// 用除法比较，记录数和记录大小相乘可能溢出
+		return header._capacity <= (_size - header._headerSize) / header._sectionSize;
+	}
+
+	PerformanceSharedMemoryReader(const PerformanceSharedMemoryReader&);
+	PerformanceSharedMemoryReader& operator=(const PerformanceSharedMemoryReader&);
+
+	const char* _data;		// 映射的共享内存
+	size_t _size;			// 共享内存大小
+#ifdef _WIN32
+	HANDLE _hMapping;
+#endif
+};
@@ -0,0 +1,330 @@
+/******************************************************************************************
+PerformanceSnapshot.h
+Copyright (c) Bit Software, Inc.(2015), All rights reserved.
+
+Purpose: 剖析报告的二进制快照格式，以及内存映射的快照读取器
+******************************************************************************************/
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#include<Windows.h>
+#else
+	#include<unistd.h>
+	#include<fcntl.h>
+	#include<sys/mman.h>
+	#include<sys/stat.h>
+#endif
+
+typedef long long LongType;
+
+//
+// 快照文件由文件头、剖析段记录表、线程记录表、直方图桶记录表和字符串表组成，
+// 各表在文件中的偏移、记录数和记录大小都保存在文件头中。记录都是定长且8字节
+// 对齐的，按写入机器的字节序保存，读取时直接映射文件按下标访问，不需要解析。
+// 时间都已换算为纳秒，不同机器、不同计时源的快照可以直接合并。
+// ps：新版本只在记录末尾追加字段，读取器按文件头中的记录大小跳转，
+// 可以读取记录更大的新版本快照。
+//
+enum
+{
+	PP_SNAPSHOT_VERSION = 1,		// 快照格式版本
+	PP_SNAPSHOT_COUNTER_COUNT = 7,	// 性能计数器个数，与PP_COUNTER一致
+	PP_SNAPSHOT_MAX_RECORD_SIZE = 4096,	// 读取时允许的最大记录大小
+};
+
+// 快照文件标识
+static const char PP_SNAPSHOT_MAGIC[4] = { 'P', 'P', 'S', 'S' };
+
+// 文件头
+struct PerformanceSnapshotHeader
+{
+	char _magic[4];					// 文件标识"PPSS"
+	unsigned int _version;			// 格式版本
+	unsigned int _headerSize;		// 文件头大小
+	unsigned int _sectionSize;		// 剖析段记录大小
+	unsigned int _threadSize;		// 线程记录大小
+	unsigned int _bucketSize;		// 直方图桶记录大小
+	unsigned int _sectionCount;		// 剖析段记录数
+	unsigned int _threadCount;		// 线程记录数
+	unsigned int _bucketCount;		// 直方图桶记录数
+	unsigned int _stringSize;		// 字符串表字节数
+	int _processId;					// 进程id
+	int _timeSource;				// 计时源
+	int _counterMask;				// 可用的性能计数器
+	int _reserved;
+	LongType _beginTime;			// 剖析开始时间(time_t)
+	LongType _snapshotTime;			// 生成快照的时间(time_t)
+	LongType _sectionOffset;		// 剖析段记录表在文件中的偏移
+	LongType _threadOffset;			// 线程记录表在文件中的偏移
+	LongType _bucketOffset;			// 直方图桶记录表在文件中的偏移
+	LongType _stringOffset;			// 字符串表在文件中的偏移
+};
+
+// 剖析段记录，字符串为字符串表中的偏移
+struct PerformanceSnapshotSection
+{
+	int _id;						// 剖析段id，对应线程记录和调用树
+	int _line;						// 行号
+	unsigned int _desc;				// 附加描述
+	unsigned int _fileName;			// 文件名
+	unsigned int _function;			// 函数名
+	unsigned int _threadBegin;		// 第一个线程记录的下标
+	unsigned int _threadCount;		// 线程记录数
+	unsigned int _bucketBegin;		// 第一个直方图桶记录的下标
+	unsigned int _bucketCount;		// 直方图桶记录数
+	unsigned int _reserved;
+	LongType _costTime;				// 总花费时间
+	LongType _callCount;			// 总调用次数
+	LongType _entryCount;			// 最外层进入次数
+	LongType _sampleCount;			// 计时次数
+	LongType _refCount;				// 引用计数，不为0表示剖析段不匹配
+	LongType _estimatedCostTime;	// 按采样估算的总花费时间
+	LongType _errorBound;			// 估算的误差范围(95%置信度)
+	LongType _minCostTime;			// 单次最小花费时间
+	LongType _maxCostTime;			// 单次最大花费时间
+	LongType _cpuTime;				// 线程CPU时间
+	LongType _cpuWallTime;			// 统计了CPU时间的那部分花费时间
+	LongType _counterCount;			// 统计了性能计数器的进入次数
+	LongType _counters[PP_SNAPSHOT_COUNTER_COUNT];	// 累计的性能计数
+	LongType _allocCount;			// 内存分配次数
+	LongType _allocBytes;			// 分配字节数
+	LongType _freeBytes;			// 释放字节数
+	LongType _peakLiveBytes;		// 未释放字节数峰值
+};
+
+// 线程记录
+struct PerformanceSnapshotThread
+{
+	int _threadId;					// 线程id
+	int _reserved;
+	LongType _costTime;				// 花费时间
+	LongType _callCount;			// 调用次数
+	LongType _entryCount;			// 最外层进入次数
+	LongType _sampleCount;			// 计时次数
+	LongType _cpuTime;				// 线程CPU时间
+	LongType _cpuWallTime;			// 统计了CPU时间的那部分花费时间
+};
+
+// 直方图桶记录，只保存计数不为0的桶
+struct PerformanceSnapshotBucket
+{
+	LongType _value;				// 桶代表的花费时间
+	LongType _count;				// 计数
+};
+
+//
+// 快照读取器
+// 只读映射整个快照文件，打开时校验文件头和各表的范围，之后的访问直接返回
+// 映射内存中的记录，不复制也不解析。
+//
+class PerformanceSnapshotReader
+{
+public:
+	PerformanceSnapshotReader()
+		:_data(NULL)
+		, _size(0)
+#ifdef _WIN32
+		, _hFile(INVALID_HANDLE_VALUE)
+		, _hMapping(NULL)
+#endif
+	{}
+
+	~PerformanceSnapshotReader()
+	{
+		Close();
+	}
+
+	bool Open(const char* path)
+	{
+		Close();
+
+#ifdef _WIN32
+		_hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (_hFile == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(_hFile, &size) || size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		_hMapping = CreateFileMapping(_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (_hMapping == NULL)
+		{
+			Close();
+			return false;
+		}
+
+		_data = (const char*)MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0);
+		_size = (size_t)size.QuadPart;
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		// 映射建立后文件描述符可以关闭
+		void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if (data == MAP_FAILED)
+			return false;
+
+		_data = (const char*)data;
+		_size = st.st_size;
+#endif
+
+		if (_data == NULL || !_Validate())
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (_data)
+			UnmapViewOfFile(_data);
+		if (_hMapping)
+			CloseHandle(_hMapping);
+		if (_hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(_hFile);
+
+		_hMapping = NULL;
+		_hFile = INVALID_HANDLE_VALUE;
+#else
+		if (_data)
+			munmap((void*)_data, _size);
+#endif
+
+		_data = NULL;
+		_size = 0;
+	}
+
+	const PerformanceSnapshotHeader& GetHeader() const
+	{
+		return *(const PerformanceSnapshotHeader*)_data;
+	}
+
+	unsigned int GetSectionCount() const
+	{
+		return GetHeader()._sectionCount;
+	}
+
+	const PerformanceSnapshotSection& GetSection(unsigned int index) const
+	{
+		const PerformanceSnapshotHeader& header = GetHeader();
+		return *(const PerformanceSnapshotSection*)(_data
+			+ header._sectionOffset + (LongType)index * header._sectionSize);
+	}
+
+	// 剖析段的第index个线程记录
+	const PerformanceSnapshotThread& GetThread(const PerformanceSnapshotSection& section,
+		unsigned int index) const
+	{
+		const PerformanceSnapshotHeader& header = GetHeader();
+		return *(const PerformanceSnapshotThread*)(_data
+			+ header._threadOffset + (LongType)(section._threadBegin + index) * header._threadSize);
+	}
+
+	// 剖析段的第index个直方图桶记录
+	const PerformanceSnapshotBucket& GetBucket(const PerformanceSnapshotSection& section,
+		unsigned int index) const
+	{
+		const PerformanceSnapshotHeader& header = GetHeader();
+		return *(const PerformanceSnapshotBucket*)(_data
+			+ header._bucketOffset + (LongType)(section._bucketBegin + index) * header._bucketSize);
+	}
+
+	// 字符串表中偏移为offset的字符串
+	const char* GetString(unsigned int offset) const
+	{
+		const PerformanceSnapshotHeader& header = GetHeader();
+		if (offset >= header._stringSize)
+			return "";
+
+		return _data + header._stringOffset + offset;
+	}
+private:
+	// 表的范围是否在文件内，用除法比较，文件中的记录数和记录大小相乘可能溢出
+	bool _InRange(LongType offset, unsigned int count, unsigned int size) const
+	{
+		if (offset < 0 || offset > (LongType)_size || size == 0)
+			return false;
+
+		return count <= ((LongType)_size - offset) / size;
+	}
+
+	//
+	// 校验文件头、各表的范围和每个剖析段引用的记录范围，
+	// 之后按下标访问时不会越界。
+	//
+	bool _Validate() const
+	{
+		if (_size < sizeof(PerformanceSnapshotHeader))
+			return false;
+
+		const PerformanceSnapshotHeader& header = GetHeader();
+		if (memcmp(header._magic, PP_SNAPSHOT_MAGIC, sizeof(PP_SNAPSHOT_MAGIC)) != 0
+			|| header._version < 1
+			|| header._headerSize < sizeof(PerformanceSnapshotHeader)
+			|| header._sectionSize < sizeof(PerformanceSnapshotSection)
+			|| header._threadSize < sizeof(PerformanceSnapshotThread)
+			|| header._bucketSize < sizeof(PerformanceSnapshotBucket)
+			|| header._sectionSize > PP_SNAPSHOT_MAX_RECORD_SIZE
+			|| header._threadSize > PP_SNAPSHOT_MAX_RECORD_SIZE
+			|| header._bucketSize > PP_SNAPSHOT_MAX_RECORD_SIZE)
+			return false;
+
+		// 记录按8字节对齐访问
+		if (header._sectionOffset % 8 || header._threadOffset % 8 || header._bucketOffset % 8
+			|| header._sectionSize % 8 || header._threadSize % 8 || header._bucketSize % 8)
+			return false;
+
+		if (!_InRange(header._sectionOffset, header._sectionCount, header._sectionSize)
+			|| !_InRange(header._threadOffset, header._threadCount, header._threadSize)
+			|| !_InRange(header._bucketOffset, header._bucketCount, header._bucketSize)
+			|| !_InRange(header._stringOffset, header._stringSize, 1))
+			return false;
+
+		// 字符串表以'\0'结尾，任何偏移处的字符串都不会越界
+		if (header._stringSize == 0 || _data[header._stringOffset + header._stringSize - 1] != '\0')
+			return false;
+
+		for (unsigned int i = 0; i < header._sectionCount; ++i)
+		{
+			const PerformanceSnapshotSection& section = GetSection(i);
+			if ((LongType)section._threadBegin + section._threadCount > header._threadCount
+				|| (LongType)section._bucketBegin + section._bucketCount > header._bucketCount)
+				return false;
+		}
+
+		return true;
+	}
+
+	PerformanceSnapshotReader(const PerformanceSnapshotReader&);
+	PerformanceSnapshotReader& operator=(const PerformanceSnapshotReader&);
+
+	const char* _data;		// 映射的文件内容
+	size_t _size;			// 文件大小
+#ifdef _WIN32
+	HANDLE _hFile;
+	HANDLE _hMapping;
+#endif
+};
@@ -3,11 +3,13 @@ using namespace std;
 
 // C++11
 #include<thread>
+#include<stdexcept>
+#include<vector>
 
 #ifdef _WIN32
 //
-// ̬⵼̬⣬UMMеĵΪ̬
-// ̬ⷽʽʹʱIMPORT̬ʱȥ޷ӳ
+// 解决动态库导出静态变量的问题，UMM中的单例类为静态对象
+// 动态库方式使用时定义宏IMPORT，静态库时去掉，否则无法会链接出错。
 //
 	#ifndef IMPORT
 		#define IMPORT
@@ -15,9 +17,21 @@ using namespace std;
 	#pragma comment(lib, "../Debug/PerformanceProfiler.lib")
 #endif // _WIN32
 
+//
+// 本编译单元只开启默认类别和网络模块类别的剖析，见Test9
+//
+#define PERFORMANCE_PROFILER_CATEGORY_MASK (PPC_DEFAULT | PPC_NETWORK)
+
 #include "../PerformanceProfiler/PerformanceProfiler.h"
 
-// 1.Ի
+// 测试用的剖析类别
+enum
+{
+	PPC_NETWORK = 2,	// 网络模块
+	PPC_STORAGE = 4,	// 存储模块，不在本编译单元的类别掩码中
+};
+
+// 1.测试基本功能
 void Test1()
 {
 	PERFORMANCE_PROFILER_EE_BEGIN(PP1, "PP1");
@@ -51,7 +65,7 @@ void MutilTreadRun(int count)
 	}
 }
 
-// 2.Զ̳߳
+// 2.测试多线程场景
 void Test2()
 {
 	thread t1(MutilTreadRun, 5);
@@ -63,11 +77,11 @@ void Test2()
 	t3.join();
 }
 
-// 3.βƥ䳡
+// 3.测试剖析段不匹配场景
 void Test3()
 {
-	// 2.ƥ
-	PERFORMANCE_PROFILER_EE_BEGIN(PP1, "ƥ");
+	// 2.正常匹配
+	PERFORMANCE_PROFILER_EE_BEGIN(PP1, "匹配");
 
 	for (int i = 0; i < 10; ++i)
 	{
@@ -76,8 +90,8 @@ void Test3()
 
 	PERFORMANCE_PROFILER_EE_END(PP1);
 
-	// 2.ƥ
-	PERFORMANCE_PROFILER_EE_BEGIN(PP2, "ƥ");
+	// 2.不匹配
+	PERFORMANCE_PROFILER_EE_BEGIN(PP2, "不匹配");
 
 	for (int i = 0; i < 10; ++i)
 	{
@@ -88,7 +102,7 @@ void Test3()
 
 int Fib(int n)
 {
-	PERFORMANCE_PROFILER_EE_BEGIN(Fib2, "ݹ");
+	PERFORMANCE_PROFILER_EE_BEGIN(Fib2, "剖析递归");
 
 	std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
@@ -107,17 +121,17 @@ int Fib(int n)
 	return ret;
 }
 
-// 4.ݹ
+// 4.测试剖析递归程序
 void Test4()
 {
-	PERFORMANCE_PROFILER_EE_BEGIN(Fib1, "");
+	PERFORMANCE_PROFILER_EE_BEGIN(Fib1, "正常");
 
 	Fib(10);
 
 	PERFORMANCE_PROFILER_EE_END(Fib1);
 }
 
-// 5.ԻԴͳ
+// 5.测试基本资源统计情况
 void Test5()
 {
 	PERFORMANCE_PROFILER_EE_RS_BEGIN(PP1, "PP1");
@@ -135,7 +149,7 @@ void Test5()
 
 //
 // http://www.cnblogs.com/Ripper-Y/archive/2012/05/19/2508511.html
-// 6.CPUռԴͳ
+// 6.CPU占用率正玄波动，测试资源统计
 //
 void Test6()
 {
@@ -175,8 +189,8 @@ void Test6()
 }
 
 //
-// 7.߿
-// Test7ԺcmdPerformanceProfilerTool.exe -pid ̺ ɲ߿
+// 7.测试在线控制剖析情况
+// 启动Test7以后，cmd下运行PerformanceProfilerTool.exe -pid 进程号 即可测试在线控制
 //
 void Test7()
 {
@@ -184,7 +198,7 @@ void Test7()
 }
 
 //
-// 8.㷨棬Ȼв鿴
+// 8.剖析快速排序算法，生成剖析报告，然后进行查看。
 //
 int GetMidIndex(int* array, int left, int right)
 {
@@ -217,8 +231,8 @@ int Partion(int* array, int left, int right)
 	PERFORMANCE_PROFILER_EE_BEGIN(Partion, "Partion");
 
 	//
-	// prevָkeyǰһλ
-	// curǰѰұkeyСݡ
+	// prev指向比key大的前一个位置
+	// cur向前寻找比key小的数据。
 	//
 
 	PERFORMANCE_PROFILER_EE_BEGIN(GetMidIndex, "GetMidIndex");
@@ -238,7 +252,7 @@ int Partion(int* array, int left, int right)
 
 	while (cur < right)
 	{
-		// ҵkeyСǰݽн
+		// 找到比key的小的数据则与前面的数据进行交换
 		if (array[cur] < key && ++prev != cur)
 		{
 			swap(array[cur], array[prev]);
@@ -260,7 +274,7 @@ void InsertSort(int* array, int size)
 
 	for (int index = 1; index < size; ++index)
 	{
-		// ǰǰ
+		// 将当前数据往前插入
 		int insertIndex = index - 1;
 		int tmp = array[index];
 		while (insertIndex >= 0 && tmp < array[insertIndex])
@@ -269,7 +283,7 @@ void InsertSort(int* array, int size)
 			--insertIndex;
 		}
 
-		// עλ
+		// 注意这里的位置
 		array[insertIndex + 1] = tmp;
 	}
 }
@@ -339,15 +353,179 @@ void Test8()
 	}
 
 	//
-	// ԱŻδŻĿ
-	// ŻԺĿδŻĿЧʡ
-	// յʾŻԺ5+
+	// 剖析对比优化和未优化的快速排序
+	// 剖析结果反馈优化以后的快速排序比未优化的快速排序效率。
+	// 最终的剖析结果显示优化以后快速排序快了5倍+。
 	//
 
 	QuickSort(a1, 0, num - 1);
 	QuickSort_OP(a2, 0, num - 1);
 }
 
+//
+// 9.测试按类别剖析，Storage剖析段在编译期被去掉，不会出现在报告中。
+//
+void Test9()
+{
+	PERFORMANCE_PROFILER_EE_CATEGORY_BEGIN(PPC_NETWORK, Network, "Network");
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	PERFORMANCE_PROFILER_EE_CATEGORY_END(Network);
+
+	PERFORMANCE_PROFILER_EE_CATEGORY_BEGIN(PPC_STORAGE, Storage, "Storage");
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	PERFORMANCE_PROFILER_EE_CATEGORY_END(Storage);
+}
+
+//
+// 10.测试作用域剖析，提前返回和抛出异常时剖析段也能正确结束，不会出现不匹配。
+//
+int Find(int* array, int size, int value)
+{
+	PERFORMANCE_PROFILER_SCOPE("Find");
+
+	for (int i = 0; i < size; ++i)
+	{
+		if (array[i] == value)
+			return i;
+	}
+
+	throw std::invalid_argument("not found");
+}
+
+void Test10()
+{
+	int array[100];
+	for (int i = 0; i < 100; ++i)
+	{
+		array[i] = i;
+	}
+
+	for (int i = 0; i < 200; ++i)
+	{
+		try
+		{
+			Find(array, 100, i);
+		}
+		catch (const std::invalid_argument&)
+		{}
+	}
+}
+
+//
+// 11.测试内存分配统计，剖析器需定义PERFORMANCE_PROFILER_TRACK_ALLOC编译，并开启PPCO_ALLOC选项。
+//
+void Test11()
+{
+	SET_PERFORMANCE_PROFILER_OPTIONS(
+		PPCO_PROFILER | PPCO_SAVE_TO_CONSOLE | PPCO_SAVE_BY_COST_TIME | PPCO_ALLOC);
+
+	for (int i = 0; i < 100; ++i)
+	{
+		PERFORMANCE_PROFILER_SCOPE("Alloc");
+
+		std::vector<int> v;
+		for (int j = 0; j < 1000; ++j)
+		{
+			v.push_back(j);
+		}
+	}
+}
+
+//
+// 12.测试JSON和CSV格式的剖析报告，生成PerformanceProfilerReport.json/.csv，时间为整数纳秒。
+//
+void Test12()
+{
+	SET_PERFORMANCE_PROFILER_OPTIONS(PPCO_PROFILER | PPCO_SAVE_TO_CONSOLE
+		| PPCO_SAVE_TO_JSON | PPCO_SAVE_TO_CSV | PPCO_CPU_TIME | PPCO_CALL_TREE);
+
+	for (int i = 0; i < 10; ++i)
+	{
+		PERFORMANCE_PROFILER_SCOPE("Outer, \"Quoted\"");
+
+		for (int j = 0; j < 10; ++j)
+		{
+			PERFORMANCE_PROFILER_SCOPE("Inner");
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+//
+// 13.测试二进制快照，生成PerformanceProfilerReport.pps后映射读取并输出各剖析段。
+// 多个快照可以用PerformanceProfilerTool -merge合并。
+//
+void Test13()
+{
+	SET_PERFORMANCE_PROFILER_OPTIONS(PPCO_PROFILER | PPCO_SAVE_TO_SNAPSHOT);
+
+	for (int i = 0; i < 100; ++i)
+	{
+		PERFORMANCE_PROFILER_SCOPE("Snapshot");
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+
+	PerformanceProfiler::GetInstance()->OutPut();
+
+	PerformanceSnapshotReader reader;
+	if (!reader.Open("PerformanceProfilerReport.pps"))
+	{
+		cout << "Open PerformanceProfilerReport.pps Failed" << endl;
+		return;
+	}
+
+	for (unsigned int i = 0; i < reader.GetSectionCount(); ++i)
+	{
+		const PerformanceSnapshotSection& section = reader.GetSection(i);
+		cout << reader.GetString(section._desc) << " "
+			<< reader.GetString(section._fileName) << ":" << section._line
+			<< " CallCount:" << section._callCount
+			<< " CostTime:" << section._costTime << "ns"
+			<< " Buckets:" << section._bucketCount << endl;
+	}
+}
+
+//
+// 14.测试周期报告，每秒输出一次增量统计到PerformanceProfilerInterval.txt，
+// 文件超过1K后轮转，保留2个旧文件。
+//
+void Test14()
+{
+	SET_PERFORMANCE_PROFILER_OPTIONS(PPCO_PROFILER | PPCO_CPU_TIME);
+	SET_PERFORMANCE_PROFILER_REPORT_ROTATION(1024, 2);
+	SET_PERFORMANCE_PROFILER_REPORT_INTERVAL(1);
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		PERFORMANCE_PROFILER_SCOPE("Interval");
+
+		// 延迟逐渐变大，各周期报告的延迟分布不同
+		std::this_thread::sleep_for(std::chrono::milliseconds(i / 100 + 1));
+	}
+
+	SET_PERFORMANCE_PROFILER_REPORT_INTERVAL(0);
+}
+
+//
+// 15.测试共享内存发布，每100毫秒发布一次统计值，运行期间可用
+// PerformanceProfilerTool -shm pid查看实时统计。
+//
+void Test15()
+{
+	SET_PERFORMANCE_PROFILER_OPTIONS(PPCO_PROFILER);
+	SET_PERFORMANCE_PROFILER_SHARED_MEMORY(100);
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		PERFORMANCE_PROFILER_SCOPE("SharedMemory");
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
 int main()
 {
 	SET_PERFORMANCE_PROFILER_OPTIONS(
@@ -361,6 +539,13 @@ int main()
 	//Test6();
 	//Test7();
 	Test8();
+	//Test9();
+	//Test10();
+	//Test11();
+	//Test12();
+	//Test13();
+	//Test14();
+	//Test15();
 
 	return 0;
 }
\ No newline at end of file
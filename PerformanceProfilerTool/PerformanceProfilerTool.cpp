@@ -2,7 +2,7 @@
 PerformanceProfilerTool.cpp:
 Copyright (c) Bit Software, Inc.(2015), All rights reserved.
 
-Purpose: ʵ߿ƹ
+Purpose: 实现性能剖析在线控制工具
 
 Author: xjh
 
@@ -16,14 +16,22 @@ Created Time: 2015-4-26
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
 using namespace std;
 
 #include "../IPC/IPCManager.h"
+#include "../PerformanceProfiler/PerformanceSnapshot.h"
+#include "../PerformanceProfiler/PerformanceSharedMemory.h"
 
 #ifdef _WIN32
 const char* SERVER_PIPE_NAME = "\\\\.\\Pipe\\PPServerPipeName";
 #else
-const char* SERVER_PIPE_NAME = "tmp/performance_profiler/_fifo";
+const char* SERVER_PIPE_NAME = "/tmp/performance_profiler_";
 #endif
 
 void UsageHelp ()
@@ -31,6 +39,8 @@ void UsageHelp ()
 	printf ("Performance ProfilerTool Tool. Bit Internal Tool\n");
 	printf ("Usage: PerformanceProfilerTool -help\n");
 	printf ("Usage: PerformanceProfilerTool -pid pid.\n");
+	printf ("Usage: PerformanceProfilerTool -merge file1.pps file2.pps ...\n");
+	printf ("Usage: PerformanceProfilerTool -shm pid [milliseconds].\n");
 	printf ("Example: PerformanceProfilerTool -pid 2345.\n");	
 
 	exit (0);
@@ -43,13 +53,69 @@ void UsageHelpInfo ()
 	printf ("    <state>:   Show the state of the Performance ProfilerTool.\n");
 	printf ("    <enable>:  Force enable performance profiler.\n");
 	printf ("    <disable>: Force disable performance profiler.\n");
-	printf ("    <save>:    Save the results to file.\n");
+	printf ("    <save [text|json|csv|snapshot]>: Save the results to file(PerformanceProfilerReport.txt/.json/.csv/.pps).\n");
+	printf ("    <report [text|json|csv|snapshot] [file]>: Pull the full report and save it to a local file(default PerformanceProfilerReport_<pid>.*).\n");
+	printf ("    <enable_section desc|file:line>:  Enable the matched sections.\n");
+	printf ("    <disable_section desc|file:line>: Disable the matched sections.\n");
+	printf ("    <sample none|every|random|interval rate desc|file:line>: Set the sampling of the matched sections.\n");
+	printf ("    <trace>:   Save the section event timeline to PerformanceProfilerTrace.json.\n");
+	printf ("    <report_interval seconds>: Append interval reports to PerformanceProfilerInterval.txt every N seconds, 0 to stop.\n");
+	printf ("    <shared_memory milliseconds>: Publish live stats to shared memory every N milliseconds for -shm, 0 to stop.\n");
+}
+
+//
+// 拉取完整的剖析报告保存到本地文件，被剖析进程不写文件。
+// 参数为"格式 [文件名]"，默认文件名为PerformanceProfilerReport_<pid>.<扩展名>
+//
+void PullReport(IPCClient& client, const string& idStr, const string& args)
+{
+	char format[16] = "text";
+	char path[512] = { 0 };
+	sscanf(args.c_str(), "%15s %511s", format, path);
+
+	const char* ext = "txt";
+	if (strcmp(format, "json") == 0)
+		ext = "json";
+	else if (strcmp(format, "csv") == 0)
+		ext = "csv";
+	else if (strcmp(format, "snapshot") == 0)
+		ext = "pps";
+
+	if (path[0] == '\0')
+	{
+		sprintf(path, "PerformanceProfilerReport_%s.%s", idStr.c_str(), ext);
+	}
+
+	string reply;
+	if (!client.Request("report", format, reply))
+	{
+		printf("Report Failed, Received:%d bytes\n\n", (int)reply.size());
+		return;
+	}
+
+	// 格式错误时回复的是用法说明
+	if (reply.compare(0, 6, "Usage:") == 0)
+	{
+		printf("%s\n\n", reply.c_str());
+		return;
+	}
+
+	FILE* fOut = fopen(path, "wb");
+	if (fOut == NULL)
+	{
+		printf("Open File Failed: %s\n\n", path);
+		return;
+	}
+
+	fwrite(reply.data(), 1, reply.size(), fOut);
+	fclose(fOut);
+
+	printf("Report Success: %s, Size:%d bytes\n\n", path, (int)reply.size());
 }
 
 void PerformanceProfilerToolClient(const string& idStr)
 {
 	char msg[1024] = {0};
-	size_t msgLen = 0;
 
 	string serverPipeName = SERVER_PIPE_NAME;
 	serverPipeName += idStr;
@@ -57,11 +123,23 @@ void PerformanceProfilerToolClient(const string& idStr)
 	UsageHelpInfo();
 
 	IPCClient client(serverPipeName.c_str());
+	string reply;
 
 	while (1)
 	{
 		printf("shell:>");
-		scanf("%s", msg);
+
+		// 按行读取命令，命令参数中可以有空格
+		if (fgets(msg, 1024, stdin) == NULL)
+		{
+			break;
+		}
+
+		msg[strcspn(msg, "\r\n")] = '\0';
+		if (msg[0] == '\0')
+		{
+			continue;
+		}
 
 		if (strcmp(msg, "help") == 0)
 		{
@@ -74,13 +152,220 @@ void PerformanceProfilerToolClient(const string& idStr)
 			break;
 		}
 
-		client.SendMsg(msg, strlen(msg));
-		client.GetReplyMsg(msg, 1024);
+		// 命令格式为"命令 参数"
+		string cmd = msg;
+		string args;
+		size_t pos = cmd.find(' ');
+		if (pos != string::npos)
+		{
+			args = cmd.substr(pos + 1);
+			cmd.resize(pos);
+		}
+
+		if (cmd == "report")
+		{
+			PullReport(client, idStr, args);
+			continue;
+		}
+
+		if (!client.Request(cmd, args, reply))
+		{
+			continue;
+		}
 
-		printf("%s\n\n", msg);
+		printf("%s\n\n", reply.c_str());
 	}
 }
 
+// 多个快照中同一剖析段合并后的统计信息
+struct MergedSection
+{
+	string _desc;
+	string _fileName;
+	string _function;
+	int _line;
+
+	LongType _costTime;
+	LongType _callCount;
+	LongType _sampleCount;
+	LongType _maxCostTime;
+	map<LongType, LongType> _buckets;	// 直方图桶代表值(纳秒) -> 计数
+
+	LongType GetPercentile(double percent) const
+	{
+		LongType total = 0;
+		for (auto it = _buckets.begin(); it != _buckets.end(); ++it)
+			total += it->second;
+
+		LongType rank = (LongType)(total * percent + 0.999999);
+		LongType count = 0;
+		for (auto it = _buckets.begin(); it != _buckets.end(); ++it)
+		{
+			count += it->second;
+			if (count >= rank)
+				return it->first;
+		}
+
+		return 0;
+	}
+};
+
+//
+// 合并多个进程/多次保存的二进制快照，按描述、文件、函数和行号匹配剖析段，
+// 累加调用次数、花费时间和直方图后输出汇总。
+// 快照直接映射读取，合并的开销主要是读文件。
+//
+int MergeSnapshots(int count, char** paths)
+{
+	vector<MergedSection> sections;
+	unordered_map<string, size_t> indexes;
+	int merged = 0;
+
+	for (int i = 0; i < count; ++i)
+	{
+		PerformanceSnapshotReader reader;
+		if (!reader.Open(paths[i]))
+		{
+			fprintf(stderr, "Invalid snapshot file: %s\n", paths[i]);
+			continue;
+		}
+
+		++merged;
+		for (unsigned int j = 0; j < reader.GetSectionCount(); ++j)
+		{
+			const PerformanceSnapshotSection& section = reader.GetSection(j);
+			const char* desc = reader.GetString(section._desc);
+			const char* fileName = reader.GetString(section._fileName);
+			const char* function = reader.GetString(section._function);
+
+			char line[16];
+			sprintf(line, "%d", section._line);
+
+			string key = desc;
+			key += '\0';
+			key += fileName;
+			key += '\0';
+			key += function;
+			key += '\0';
+			key += line;
+
+			auto it = indexes.find(key);
+			if (it == indexes.end())
+			{
+				MergedSection ms;
+				ms._desc = desc;
+				ms._fileName = fileName;
+				ms._function = function;
+				ms._line = section._line;
+				ms._costTime = 0;
+				ms._callCount = 0;
+				ms._sampleCount = 0;
+				ms._maxCostTime = 0;
+
+				it = indexes.insert(make_pair(key, sections.size())).first;
+				sections.push_back(ms);
+			}
+
+			MergedSection& ms = sections[it->second];
+			ms._costTime += section._estimatedCostTime;
+			ms._callCount += section._callCount;
+			ms._sampleCount += section._sampleCount;
+			ms._maxCostTime = max(ms._maxCostTime, section._maxCostTime);
+
+			for (unsigned int k = 0; k < section._bucketCount; ++k)
+			{
+				const PerformanceSnapshotBucket& bucket = reader.GetBucket(section, k);
+				ms._buckets[bucket._value] += bucket._count;
+			}
+		}
+	}
+
+	// 按总花费时间排序
+	vector<const MergedSection*> vSections;
+	for (size_t i = 0; i < sections.size(); ++i)
+		vSections.push_back(&sections[i]);
+
+	sort(vSections.begin(), vSections.end(),
+		[](const MergedSection* l, const MergedSection* r)
+	{
+		return l->_costTime > r->_costTime;
+	});
+
+	printf("Merged %d snapshots, %d sections\n", merged, (int)vSections.size());
+	printf("%-12s %-14s %-12s %-12s %-12s %s\n",
+		"CallCount", "CostTime(ms)", "P50(us)", "P99(us)", "Max(us)", "Section");
+	for (size_t i = 0; i < vSections.size(); ++i)
+	{
+		const MergedSection& ms = *vSections[i];
+		printf("%-12lld %-14.3f %-12.3f %-12.3f %-12.3f %s %s:%d %s\n",
+			ms._callCount, ms._costTime / 1000000.0,
+			ms.GetPercentile(0.5) / 1000.0, ms.GetPercentile(0.99) / 1000.0,
+			ms._maxCostTime / 1000.0,
+			ms._desc.c_str(), ms._fileName.c_str(), ms._line, ms._function.c_str());
+	}
+
+	return merged == count ? 0 : 1;
+}
+
+//
+// 只读映射被剖析进程的共享内存区，每隔一段时间输出一次实时统计，
+// 不向被剖析进程发送命令，也不会打断它。
+//
+int ShowSharedMemory(int processId, int milliseconds)
+{
+	PerformanceSharedMemoryReader reader;
+	if (!reader.Open(processId))
+	{
+		fprintf(stderr, "Open Shared Memory Failed, Pid:%d. "
+			"Enable it by shared_memory command first.\n", processId);
+		return 1;
+	}
+
+	const PerformanceSharedMemoryHeader& header = reader.GetHeader();
+	vector<LongType> lastCallCounts;
+	chrono::steady_clock::time_point lastTime = chrono::steady_clock::now();
+
+	while (1)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		double seconds = chrono::duration<double>(now - lastTime).count();
+		lastTime = now;
+
+		unsigned int count = reader.GetSectionCount();
+		printf("==== Pid:%d, Update Count:%lld, Sections:%u, Dropped:%u ====\n",
+			header._processId, header._updateCount.load(), count, header._droppedCount.load());
+		printf("%-12s %-12s %-14s %-12s %-12s %-12s %s\n",
+			"CallCount", "Calls/s", "CostTime(ms)", "P50(us)", "P99(us)", "Max(us)", "Section");
+
+		lastCallCounts.resize(count, -1);
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			PerformanceSharedMemoryStatistics statistics;
+			if (!reader.ReadStatistics(i, statistics))
+				continue;
+
+			// 每秒调用次数按两次读取之间的增量计算
+			double rate = 0;
+			if (lastCallCounts[i] >= 0 && seconds > 0)
+				rate = (statistics._callCount - lastCallCounts[i]) / seconds;
+			lastCallCounts[i] = statistics._callCount;
+
+			const PerformanceSharedMemorySection& section = reader.GetSection(i);
+			printf("%-12lld %-12.1f %-14.3f %-12.3f %-12.3f %-12.3f %s %s:%d %s\n",
+				statistics._callCount, rate, statistics._costTime / 1000000.0,
+				statistics._p50 / 1000.0, statistics._p99 / 1000.0, statistics._maxCostTime / 1000.0,
+				section._desc, section._fileName, section._line, section._function);
+		}
+
+		printf("\n");
+		fflush(stdout);
+
+		this_thread::sleep_for(chrono::milliseconds(milliseconds));
+	}
+
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
 	string idStr;
@@ -89,6 +374,15 @@ int main(int argc, char** argv)
 		UsageHelpInfo();
 
 	}
+	else if (argc >= 3 && !strcmp(argv[1], "-merge"))
+	{
+		return MergeSnapshots(argc - 2, argv + 2);
+	}
+	else if ((argc == 3 || argc == 4) && !strcmp(argv[1], "-shm"))
+	{
+		int milliseconds = argc == 4 ? atoi(argv[3]) : 1000;
+		return ShowSharedMemory(atoi(argv[2]), milliseconds > 0 ? milliseconds : 1000);
+	}
 	else if (argc == 3 && !strcmp(argv[1], "-pid"))
 	{
 		idStr += argv[2];